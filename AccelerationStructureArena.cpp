@@ -0,0 +1,316 @@
+/***************************************************************************
+ # Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "stdafx.h"
+#include "AccelerationStructureArena.h"
+#include <random>
+
+namespace Falcor
+{
+    namespace
+    {
+        uint64_t alignUp(uint64_t value, uint64_t alignment)
+        {
+            return (value + alignment - 1) / alignment * alignment;
+        }
+    }
+
+    void RangeAllocator::reset(uint64_t capacity)
+    {
+        mCapacity = capacity;
+        mFreeBytes = capacity;
+        mFreeBlocks.clear();
+        if (capacity > 0) mFreeBlocks[0] = capacity;
+    }
+
+    uint64_t RangeAllocator::allocate(uint64_t size, uint64_t alignment)
+    {
+        assert(alignment > 0);
+        if (size == 0) return kInvalidOffset;
+
+        // Best fit: the smallest block that can hold the aligned allocation.
+        auto best = mFreeBlocks.end();
+        uint64_t bestWaste = ~0ull;
+        for (auto it = mFreeBlocks.begin(); it != mFreeBlocks.end(); ++it)
+        {
+            uint64_t alignedOffset = alignUp(it->first, alignment);
+            uint64_t padding = alignedOffset - it->first;
+            if (padding + size > it->second) continue;
+
+            uint64_t waste = it->second - size;
+            if (waste < bestWaste)
+            {
+                best = it;
+                bestWaste = waste;
+                if (waste == 0) break;
+            }
+        }
+        if (best == mFreeBlocks.end()) return kInvalidOffset;
+
+        uint64_t blockOffset = best->first;
+        uint64_t blockSize = best->second;
+        uint64_t offset = alignUp(blockOffset, alignment);
+        mFreeBlocks.erase(best);
+
+        // Return the alignment padding and the tail to the free list.
+        if (offset > blockOffset) mFreeBlocks[blockOffset] = offset - blockOffset;
+        uint64_t tail = blockOffset + blockSize - (offset + size);
+        if (tail > 0) mFreeBlocks[offset + size] = tail;
+
+        mFreeBytes -= size;
+        return offset;
+    }
+
+    void RangeAllocator::release(uint64_t offset, uint64_t size)
+    {
+        assert(offset + size <= mCapacity);
+        assert(mFreeBlocks.find(offset) == mFreeBlocks.end());
+
+        auto it = mFreeBlocks.emplace(offset, size).first;
+        mFreeBytes += size;
+
+        // Merge with the next block.
+        auto next = std::next(it);
+        if (next != mFreeBlocks.end() && it->first + it->second == next->first)
+        {
+            it->second += next->second;
+            mFreeBlocks.erase(next);
+        }
+
+        // Merge with the previous block.
+        if (it != mFreeBlocks.begin())
+        {
+            auto prev = std::prev(it);
+            assert(prev->first + prev->second <= it->first);
+            if (prev->first + prev->second == it->first)
+            {
+                prev->second += it->second;
+                mFreeBlocks.erase(it);
+            }
+        }
+    }
+
+    uint64_t RangeAllocator::getLargestFreeBlock() const
+    {
+        uint64_t largest = 0;
+        for (const auto& block : mFreeBlocks) largest = std::max(largest, block.second);
+        return largest;
+    }
+
+    float RangeAllocator::getFragmentation() const
+    {
+        if (mFreeBytes == 0) return 0.f;
+        return 1.f - float(getLargestFreeBlock()) / float(mFreeBytes);
+    }
+
+    AccelerationStructureArena::Allocation AccelerationStructureArena::allocate(uint64_t size)
+    {
+        size = alignUp(size, kAlignment);
+
+        Allocation allocation;
+        allocation.size = size;
+
+        for (uint32_t i = 0; i < (uint32_t)mPages.size(); i++)
+        {
+            auto& page = mPages[i];
+            if (page.pBuffer == nullptr) continue;
+
+            uint64_t offset = page.allocator.allocate(size, kAlignment);
+            if (offset == RangeAllocator::kInvalidOffset) continue;
+
+            allocation.pBuffer = page.pBuffer;
+            allocation.offset = offset;
+            allocation.pageIndex = i;
+            return allocation;
+        }
+
+        // No room left. Reuse a released page slot if there is one, otherwise add a page.
+        uint32_t pageIndex = (uint32_t)mPages.size();
+        for (uint32_t i = 0; i < (uint32_t)mPages.size(); i++)
+        {
+            if (mPages[i].pBuffer == nullptr) { pageIndex = i; break; }
+        }
+        if (pageIndex == mPages.size()) mPages.push_back({});
+
+        auto& page = mPages[pageIndex];
+        uint64_t pageSize = std::max(mPageSize, size);
+        page.pBuffer = Buffer::create(pageSize, Buffer::BindFlags::AccelerationStructure, Buffer::CpuAccess::None);
+        page.allocator.reset(pageSize);
+
+        allocation.pBuffer = page.pBuffer;
+        allocation.offset = page.allocator.allocate(size, kAlignment);
+        allocation.pageIndex = pageIndex;
+        assert(allocation.offset == 0);
+        return allocation;
+    }
+
+    void AccelerationStructureArena::release(Allocation& allocation)
+    {
+        if (!allocation.isValid()) return;
+        assert(allocation.pageIndex < mPages.size() && mPages[allocation.pageIndex].pBuffer == allocation.pBuffer);
+
+        auto& page = mPages[allocation.pageIndex];
+        page.allocator.release(allocation.offset, allocation.size);
+
+        // The buffer itself is released once the GPU is done with it.
+        if (page.allocator.getUsedBytes() == 0) page.pBuffer = nullptr;
+
+        allocation = {};
+    }
+
+    uint64_t AccelerationStructureArena::getReservedBytes() const
+    {
+        uint64_t bytes = 0;
+        for (const auto& page : mPages) if (page.pBuffer) bytes += page.allocator.getCapacity();
+        return bytes;
+    }
+
+    uint64_t AccelerationStructureArena::getUsedBytes() const
+    {
+        uint64_t bytes = 0;
+        for (const auto& page : mPages) if (page.pBuffer) bytes += page.allocator.getUsedBytes();
+        return bytes;
+    }
+
+    uint32_t AccelerationStructureArena::getPageCount() const
+    {
+        uint32_t count = 0;
+        for (const auto& page : mPages) if (page.pBuffer) count++;
+        return count;
+    }
+
+    bool AccelerationStructureArena::runSelfCheck()
+    {
+        bool success = true;
+        auto check = [&](bool condition, const std::string& what)
+        {
+            if (!condition) logError("AccelerationStructureArena self-check failed: " + what);
+            success = success && condition;
+        };
+
+        // Freed neighbors coalesce, in either release order
+        {
+            RangeAllocator allocator(1024);
+            uint64_t a = allocator.allocate(100, 1), b = allocator.allocate(200, 1), c = allocator.allocate(300, 1);
+            check(a == 0 && b == 100 && c == 300, "sequential allocations are not packed");
+            allocator.release(b, 200);
+            check(allocator.getFreeBlockCount() == 2, "released middle block merged with a used neighbor");
+            allocator.release(a, 100);
+            check(allocator.getFreeBlockCount() == 2 && allocator.getLargestFreeBlock() == 424, "block not merged with its free successor");
+            allocator.release(c, 300);
+            check(allocator.getFreeBlockCount() == 1 && allocator.getLargestFreeBlock() == 1024 && allocator.getFreeBytes() == 1024, "fully released range did not coalesce");
+        }
+
+        // Best fit picks the smallest hole that fits, not the first one
+        {
+            RangeAllocator allocator(1000);
+            uint64_t a = allocator.allocate(300, 1), b = allocator.allocate(100, 1), c = allocator.allocate(100, 1), d = allocator.allocate(100, 1);
+            allocator.release(a, 300);
+            allocator.release(c, 100);
+            check(allocator.allocate(90, 1) == c, "allocation did not use the best-fitting block");
+            check(allocator.allocate(300, 1) == a, "allocation did not use the exactly fitting block");
+            check(allocator.allocate(400, 1) == 600 && allocator.getFreeBytes() == 10, "tail block not used");
+            check(allocator.allocate(11, 1) == RangeAllocator::kInvalidOffset, "allocation larger than any free block succeeded");
+            (void)b; (void)d;
+        }
+
+        // Alignment padding stays free and is reusable
+        {
+            RangeAllocator allocator(4096);
+            uint64_t a = allocator.allocate(10, 1);
+            uint64_t b = allocator.allocate(256, 256);
+            check(a == 0 && b == 256, "aligned allocation not at the next aligned offset");
+            check(allocator.getFreeBytes() == 4096 - 266, "alignment padding counted as used");
+            check(allocator.allocate(246, 1) == 10, "alignment padding not returned to the free list");
+        }
+
+        // Random sequences against a model of the live ranges
+        {
+            const uint64_t kCapacity = 1 << 20;
+            RangeAllocator allocator(kCapacity);
+            std::map<uint64_t, uint64_t> live;
+            uint64_t liveBytes = 0;
+            std::mt19937 rng(1234);
+
+            for (uint32_t op = 0; op < 20000 && success; op++)
+            {
+                if (live.empty() || rng() % 3 != 0)
+                {
+                    uint64_t size = 1 + rng() % 4096;
+                    uint64_t alignment = 1ull << (rng() % 9);
+                    uint64_t offset = allocator.allocate(size, alignment);
+                    if (offset == RangeAllocator::kInvalidOffset) continue;
+
+                    check(offset % alignment == 0, "offset " + std::to_string(offset) + " not aligned to " + std::to_string(alignment));
+                    check(offset + size <= kCapacity, "allocation past the end of the range");
+                    auto next = live.lower_bound(offset);
+                    check(next == live.end() || offset + size <= next->first, "allocation overlaps the following live range");
+                    check(next == live.begin() || std::prev(next)->first + std::prev(next)->second <= offset, "allocation overlaps the preceding live range");
+                    live[offset] = size;
+                    liveBytes += size;
+                }
+                else
+                {
+                    auto it = std::next(live.begin(), rng() % live.size());
+                    allocator.release(it->first, it->second);
+                    liveBytes -= it->second;
+                    live.erase(it);
+                }
+                check(allocator.getUsedBytes() == liveBytes, "used bytes out of sync with the live allocations");
+            }
+
+            for (const auto& range : live) allocator.release(range.first, range.second);
+            check(allocator.getFreeBlockCount() == 1 && allocator.getLargestFreeBlock() == kCapacity, "range did not coalesce after releasing everything");
+        }
+
+        // Pages are added when full, oversized allocations get their own page, empty pages are released
+        {
+            const uint64_t kPageSize = 16 * kAlignment;
+            AccelerationStructureArena arena(kPageSize);
+            std::vector<Allocation> allocations;
+            for (uint32_t i = 0; i < 20; i++) allocations.push_back(arena.allocate(kAlignment - 1));
+            check(arena.getPageCount() == 2 && arena.getUsedBytes() == 20 * kAlignment, "arena did not grow by one page when full");
+            for (const auto& a : allocations) check(a.offset % kAlignment == 0 && a.size == kAlignment, "arena allocation not aligned");
+
+            Allocation large = arena.allocate(3 * kPageSize);
+            check(large.offset == 0 && large.pBuffer->getSize() >= 3 * kPageSize && arena.getPageCount() == 3, "oversized allocation did not get its own page");
+            arena.release(large);
+            check(arena.getPageCount() == 2 && !large.isValid(), "empty oversized page not released");
+
+            for (uint32_t i = 0; i < 16; i++) arena.release(allocations[i]);
+            check(arena.getPageCount() == 1 && arena.getUsedBytes() == 4 * kAlignment, "empty page not released");
+            Allocation reused = arena.allocate(kAlignment);
+            check(reused.pageIndex == allocations[16].pageIndex, "free space in a live page not reused");
+            arena.release(reused);
+            for (uint32_t i = 16; i < 20; i++) arena.release(allocations[i]);
+            check(arena.getPageCount() == 0 && arena.getReservedBytes() == 0, "arena not empty after releasing everything");
+        }
+
+        if (success) logInfo("AccelerationStructureArena self-check passed");
+        return success;
+    }
+}
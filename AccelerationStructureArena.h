@@ -0,0 +1,121 @@
+/***************************************************************************
+ # Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#pragma once
+#include <map>
+
+namespace Falcor
+{
+    /** First-fit/best-fit free-list allocator over a linear range of bytes.
+        It only hands out offsets and has no GPU dependency.
+        Freed blocks are merged with free neighbors, so fragmentation stays bounded by the allocation pattern.
+    */
+    class RangeAllocator
+    {
+    public:
+        static const uint64_t kInvalidOffset = ~0ull;
+
+        RangeAllocator(uint64_t capacity = 0) { reset(capacity); }
+
+        /** Drop all allocations and make the whole range free.
+        */
+        void reset(uint64_t capacity);
+
+        /** Allocate a block. The smallest free block that fits is used.
+            \return Offset of the block, or kInvalidOffset if no free block is large enough.
+        */
+        uint64_t allocate(uint64_t size, uint64_t alignment);
+
+        /** Return a block previously returned by allocate() with the same size.
+        */
+        void release(uint64_t offset, uint64_t size);
+
+        uint64_t getCapacity() const { return mCapacity; }
+        uint64_t getFreeBytes() const { return mFreeBytes; }
+        uint64_t getUsedBytes() const { return mCapacity - mFreeBytes; }
+        uint64_t getLargestFreeBlock() const;
+        size_t getFreeBlockCount() const { return mFreeBlocks.size(); }
+
+        /** Fraction of free memory that is not part of the largest free block. 0 means no fragmentation.
+        */
+        float getFragmentation() const;
+
+    private:
+        uint64_t mCapacity = 0;
+        uint64_t mFreeBytes = 0;
+        std::map<uint64_t, uint64_t> mFreeBlocks;   ///< Free blocks, offset to size.
+    };
+
+    /** Suballocates acceleration structures from large buffers instead of creating one committed resource per BLAS.
+        Allocations larger than the page size get a page of their own. Pages that become empty are released.
+    */
+    class AccelerationStructureArena
+    {
+    public:
+        static const uint64_t kAlignment = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT;
+        static const uint64_t kDefaultPageSize = 32ull * 1024 * 1024;
+
+        struct Allocation
+        {
+            Buffer::SharedPtr pBuffer;      ///< Page the allocation lives in. Use it for barriers.
+            uint64_t offset = 0;
+            uint64_t size = 0;
+            uint32_t pageIndex = 0;
+
+            bool isValid() const { return pBuffer != nullptr; }
+            uint64_t getGpuAddress() const { return pBuffer->getGpuAddress() + offset; }
+        };
+
+        AccelerationStructureArena(uint64_t pageSize = kDefaultPageSize) : mPageSize(pageSize) {}
+
+        Allocation allocate(uint64_t size);
+        void release(Allocation& allocation);
+
+        /** Total size of all live pages.
+        */
+        uint64_t getReservedBytes() const;
+        uint64_t getUsedBytes() const;
+        uint32_t getPageCount() const;
+
+        /** Run deterministic and randomized allocate/release sequences on RangeAllocator and on a small-page arena.
+            Checks alignment, disjoint live ranges, best fit, coalescing of freed neighbors and page growth and release.
+            The arena part creates GPU buffers, so it needs a device.
+            \return True if all checks pass. Failures are logged.
+        */
+        static bool runSelfCheck();
+
+    private:
+        struct Page
+        {
+            Buffer::SharedPtr pBuffer;
+            RangeAllocator allocator;
+        };
+
+        uint64_t mPageSize;
+        std::vector<Page> mPages;
+    };
+}
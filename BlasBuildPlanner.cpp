@@ -0,0 +1,133 @@
+/***************************************************************************
+ # Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "stdafx.h"
+#include "BlasBuildPlanner.h"
+#include <random>
+
+namespace Falcor
+{
+    namespace
+    {
+        // Returns an empty string if the plan is valid for the sizes, otherwise a description of the first problem
+        std::string validatePlan(const BlasBuildPlanner& planner, const std::vector<uint64_t>& scratchSizes, uint64_t budget, uint64_t alignment)
+        {
+            // Batches must be consecutive and cover every build once
+            size_t nextBuild = 0;
+            for (const auto& batch : planner.getBatches())
+            {
+                if (batch.buildCount == 0) return "empty batch";
+                if (batch.firstBuild != nextBuild) return "batch starts at build " + std::to_string(batch.firstBuild) + ", expected " + std::to_string(nextBuild);
+                nextBuild += batch.buildCount;
+                if (nextBuild > scratchSizes.size()) return "batch past the last build";
+                if (batch.buildCount > 1 && batch.scratchSize > budget) return "batch at build " + std::to_string(batch.firstBuild) + " uses " + std::to_string(batch.scratchSize) + " bytes, over the budget";
+                if (batch.scratchSize > planner.getScratchBufferSize()) return "batch at build " + std::to_string(batch.firstBuild) + " doesn't fit the scratch buffer";
+
+                // Ranges are sorted by offset within a batch, so disjoint means each one starts at or after the end of the previous one
+                uint64_t end = 0;
+                for (size_t i = batch.firstBuild; i < batch.firstBuild + batch.buildCount; i++)
+                {
+                    uint64_t offset = planner.getScratchOffset(i);
+                    if (offset % alignment) return "build " + std::to_string(i) + " has an unaligned scratch offset";
+                    if (offset < end) return "build " + std::to_string(i) + " overlaps the previous scratch range";
+                    end = offset + scratchSizes[i];
+                    if (end > batch.scratchSize) return "build " + std::to_string(i) + " ends past its batch's scratch size";
+                }
+            }
+            if (nextBuild != scratchSizes.size()) return std::to_string(scratchSizes.size() - nextBuild) + " builds not planned";
+            return "";
+        }
+    }
+
+    void BlasBuildPlanner::plan(const std::vector<uint64_t>& scratchSizes, uint64_t budget, uint64_t alignment)
+    {
+        assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+
+        mBatches.clear();
+        mScratchOffsets.resize(scratchSizes.size());
+        mScratchBufferSize = 0;
+
+        Batch batch;
+        for (size_t i = 0; i < scratchSizes.size(); i++)
+        {
+            uint64_t size = (scratchSizes[i] + alignment - 1) & ~(alignment - 1);
+            if (batch.buildCount > 0 && batch.scratchSize + size > budget)
+            {
+                mBatches.push_back(batch);
+                batch = Batch();
+            }
+
+            if (batch.buildCount == 0) batch.firstBuild = i;
+            mScratchOffsets[i] = batch.scratchSize;
+            batch.scratchSize += size;
+            batch.buildCount++;
+            mScratchBufferSize = std::max(mScratchBufferSize, batch.scratchSize);
+        }
+
+        if (batch.buildCount > 0) mBatches.push_back(batch);
+    }
+
+    bool BlasBuildPlanner::runSelfCheck()
+    {
+        bool success = true;
+        auto check = [&](const std::string& name, const std::vector<uint64_t>& scratchSizes, uint64_t budget, uint64_t alignment, size_t expectedBatchCount)
+        {
+            BlasBuildPlanner planner;
+            planner.plan(scratchSizes, budget, alignment);
+            std::string error = validatePlan(planner, scratchSizes, budget, alignment);
+            if (error.empty() && expectedBatchCount != size_t(-1) && planner.getBatches().size() != expectedBatchCount)
+            {
+                error = std::to_string(planner.getBatches().size()) + " batches, expected " + std::to_string(expectedBatchCount);
+            }
+            if (!error.empty()) logError("BlasBuildPlanner self-check '" + name + "' failed: " + error);
+            success = success && error.empty();
+        };
+
+        // Fixed size lists
+        check("no builds", {}, 1024, 256, 0);
+        check("all in one batch", { 256, 256, 256 }, 1024, 256, 1);
+        check("exact fit", { 512, 512, 512, 512 }, 1024, 256, 2);
+        check("alignment padding", { 1, 1, 1, 1, 1 }, 512, 256, 3);
+        check("build larger than the budget", { 256, 4096, 256 }, 1024, 256, 3);
+        check("only builds larger than the budget", { 2048, 4096 }, 1024, 256, 2);
+        check("mixed alignment", { 100, 300, 50, 700, 10 }, 1024, 256, 2);
+
+        // Random size lists. The batch count isn't predicted, the plan is only validated.
+        std::mt19937 rng(1234);
+        for (uint32_t iteration = 0; iteration < 1000 && success; iteration++)
+        {
+            uint64_t alignment = 1ull << (rng() % 9);
+            uint64_t budget = 1 + rng() % (1 << 16);
+            std::vector<uint64_t> scratchSizes(rng() % 64);
+            for (auto& size : scratchSizes) size = 1 + rng() % (budget * 3 / 2 + 1);
+            check("random sizes " + std::to_string(iteration), scratchSizes, budget, alignment, size_t(-1));
+        }
+
+        if (success) logInfo("BlasBuildPlanner self-check passed");
+        return success;
+    }
+}
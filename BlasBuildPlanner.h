@@ -0,0 +1,76 @@
+/***************************************************************************
+ # Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#pragma once
+#include <vector>
+
+namespace Falcor
+{
+    /** Groups BLAS builds into batches that share one scratch buffer.
+        Builds in a batch use disjoint scratch ranges, so they can be issued back to back and only need a barrier after the batch.
+        The planner only deals with sizes and has no GPU dependency.
+    */
+    class BlasBuildPlanner
+    {
+    public:
+        struct Batch
+        {
+            size_t firstBuild = 0;      ///< Index of the first build in the batch.
+            size_t buildCount = 0;      ///< Number of consecutive builds in the batch.
+            uint64_t scratchSize = 0;   ///< Scratch memory used by the batch.
+        };
+
+        /** Split builds into batches, keeping their order.
+            A batch is closed when adding the next build would exceed the budget. A build larger than the budget gets a batch of its own.
+            \param[in] scratchSizes Scratch memory required by each build.
+            \param[in] budget Scratch memory allowed per batch.
+            \param[in] alignment Alignment of each build's scratch range.
+        */
+        void plan(const std::vector<uint64_t>& scratchSizes, uint64_t budget, uint64_t alignment);
+
+        const std::vector<Batch>& getBatches() const { return mBatches; }
+
+        /** Offset of a build's range in the scratch buffer.
+        */
+        uint64_t getScratchOffset(size_t buildIndex) const { return mScratchOffsets[buildIndex]; }
+
+        /** Size of the scratch buffer needed to run any batch of the plan.
+        */
+        uint64_t getScratchBufferSize() const { return mScratchBufferSize; }
+
+        /** Check plans of fixed and random size lists: every build is planned exactly once and in order, batches respect the budget unless they hold
+            a single larger build, and scratch ranges are aligned, disjoint within their batch and inside the scratch buffer.
+            \return True if all checks pass. Failures are logged.
+        */
+        static bool runSelfCheck();
+
+    private:
+        std::vector<Batch> mBatches;
+        std::vector<uint64_t> mScratchOffsets;
+        uint64_t mScratchBufferSize = 0;
+    };
+}
@@ -0,0 +1,196 @@
+/***************************************************************************
+ # Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "stdafx.h"
+#include "DirtyRangeTracker.h"
+#include <random>
+
+namespace Falcor
+{
+    namespace
+    {
+        using Range = DirtyRangeTracker::Range;
+
+        // Dirty runs of the mask, merged when at most maxGap clean elements separate them
+        std::vector<Range> rangesFromMask(const std::vector<bool>& dirty, uint32_t maxGap)
+        {
+            std::vector<Range> ranges;
+            for (uint32_t i = 0; i < (uint32_t)dirty.size(); i++)
+            {
+                if (!dirty[i]) continue;
+                if (!ranges.empty() && i <= ranges.back().end + maxGap) ranges.back().end = i + 1;
+                else ranges.push_back({ i, i + 1 });
+            }
+            return ranges;
+        }
+
+        std::string toString(const std::vector<Range>& ranges)
+        {
+            std::string s;
+            for (const auto& r : ranges) s += "[" + std::to_string(r.begin) + ", " + std::to_string(r.end) + ") ";
+            return s;
+        }
+    }
+
+    void DirtyRangeTracker::markRange(uint32_t begin, uint32_t end)
+    {
+        if (begin >= end) return;
+
+        if (!mRanges.empty())
+        {
+            Range& last = mRanges.back();
+            if (begin >= last.begin && begin <= last.end + mMaxGap)
+            {
+                last.end = std::max(last.end, end);
+                return;
+            }
+            if (begin < last.begin) mSorted = false;
+        }
+        mRanges.push_back({ begin, end });
+    }
+
+    const std::vector<DirtyRangeTracker::Range>& DirtyRangeTracker::getRanges()
+    {
+        if (mSorted) return mRanges;
+
+        std::sort(mRanges.begin(), mRanges.end(), [](const Range& a, const Range& b) { return a.begin < b.begin; });
+
+        size_t count = 0;
+        for (size_t i = 1; i < mRanges.size(); i++)
+        {
+            Range& last = mRanges[count];
+            if (mRanges[i].begin <= last.end + mMaxGap) last.end = std::max(last.end, mRanges[i].end);
+            else mRanges[++count] = mRanges[i];
+        }
+        mRanges.resize(count + 1);
+        mSorted = true;
+        return mRanges;
+    }
+
+    void DirtyRangeTracker::clamp(uint32_t elementCount)
+    {
+        getRanges();
+        while (!mRanges.empty() && mRanges.back().begin >= elementCount) mRanges.pop_back();
+        if (!mRanges.empty()) mRanges.back().end = std::min(mRanges.back().end, elementCount);
+    }
+
+    uint32_t DirtyRangeTracker::getElementCount()
+    {
+        uint32_t count = 0;
+        for (const auto& r : getRanges()) count += r.end - r.begin;
+        return count;
+    }
+
+    bool DirtyRangeTracker::runSelfCheck()
+    {
+        bool success = true;
+        auto check = [&](const std::string& name, DirtyRangeTracker& tracker, const std::vector<Range>& expected)
+        {
+            const auto& ranges = tracker.getRanges();
+            bool match = ranges.size() == expected.size();
+            for (size_t i = 0; i < ranges.size() && match; i++) match = ranges[i].begin == expected[i].begin && ranges[i].end == expected[i].end;
+            if (!match) logError("DirtyRangeTracker self-check '" + name + "' failed: got " + toString(ranges) + ", expected " + toString(expected));
+            success = success && match;
+        };
+
+        // Fixed sequences. Each runs against a fresh tracker.
+        struct Case
+        {
+            std::string name;
+            uint32_t maxGap;
+            std::vector<Range> marks;
+            std::vector<Range> expected;
+        };
+        const Case kCases[] =
+        {
+            { "consecutive marks", 0, { { 5, 6 }, { 6, 7 }, { 7, 8 }, { 9, 10 } }, { { 5, 8 }, { 9, 10 } } },
+            { "adjacent ranges", 0, { { 0, 4 }, { 4, 8 } }, { { 0, 8 } } },
+            { "overlapping ranges", 0, { { 0, 6 }, { 4, 10 } }, { { 0, 10 } } },
+            { "contained range", 0, { { 0, 100 }, { 10, 20 } }, { { 0, 100 } } },
+            { "repeated mark", 0, { { 3, 4 }, { 3, 4 }, { 3, 4 } }, { { 3, 4 } } },
+            { "out-of-order overlap", 0, { { 10, 20 }, { 0, 12 } }, { { 0, 20 } } },
+            { "out-of-order adjacent", 0, { { 4, 8 }, { 0, 4 } }, { { 0, 8 } } },
+            { "out-of-order marks", 0, { { 9, 10 }, { 3, 4 }, { 5, 6 }, { 1, 2 } }, { { 1, 2 }, { 3, 4 }, { 5, 6 }, { 9, 10 } } },
+            { "out-of-order gap merge", 1, { { 9, 10 }, { 3, 4 }, { 5, 6 }, { 1, 2 } }, { { 1, 6 }, { 9, 10 } } },
+            { "gap at limit", 2, { { 0, 1 }, { 3, 4 } }, { { 0, 4 } } },
+            { "gap past limit", 2, { { 0, 1 }, { 4, 5 } }, { { 0, 1 }, { 4, 5 } } },
+            { "out-of-order bridge", 1, { { 0, 2 }, { 6, 8 }, { 3, 5 } }, { { 0, 8 } } },
+        };
+
+        for (const auto& c : kCases)
+        {
+            DirtyRangeTracker tracker(c.maxGap);
+            for (const auto& r : c.marks) tracker.markRange(r.begin, r.end);
+            check(c.name, tracker, c.expected);
+        }
+
+        DirtyRangeTracker counted(2);
+        counted.mark(0);
+        counted.mark(3);
+        counted.mark(7);
+        if (counted.getElementCount() != 5)
+        {
+            logError("DirtyRangeTracker self-check failed: element count " + std::to_string(counted.getElementCount()) + ", expected 5");
+            success = false;
+        }
+
+        // Marks past the end of a shrunk array are dropped, a range crossing the end is cut
+        DirtyRangeTracker clamped;
+        clamped.mark(9);
+        clamped.markRange(2, 6);
+        clamped.mark(12);
+        clamped.clamp(5);
+        check("clamp", clamped, { { 2, 5 } });
+
+        // Random sequences, in order and shuffled, against the mask. The tracker is reused across iterations like the scene's trackers are.
+        std::mt19937 rng(1234);
+        DirtyRangeTracker tracker;
+        for (uint32_t iteration = 0; iteration < 1000; iteration++)
+        {
+            const uint32_t kElementCount = 256;
+            uint32_t maxGap = (uint32_t)(rng() % 5);
+            std::vector<bool> dirty(kElementCount, false);
+            std::vector<Range> marks(1 + rng() % 32);
+            for (auto& r : marks)
+            {
+                r.begin = rng() % kElementCount;
+                r.end = std::min(kElementCount, r.begin + 1 + (uint32_t)(rng() % 8));
+                for (uint32_t i = r.begin; i < r.end; i++) dirty[i] = true;
+            }
+            if (iteration % 2) std::sort(marks.begin(), marks.end(), [](const Range& a, const Range& b) { return a.begin < b.begin; });
+
+            tracker.clear();
+            tracker.setMaxGap(maxGap);
+            for (const auto& r : marks) tracker.markRange(r.begin, r.end);
+            check("random sequence " + std::to_string(iteration), tracker, rangesFromMask(dirty, maxGap));
+            if (!success) break;
+        }
+
+        if (success) logInfo("DirtyRangeTracker self-check passed");
+        return success;
+    }
+}
@@ -0,0 +1,79 @@
+/***************************************************************************
+ # Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#pragma once
+#include <vector>
+
+namespace Falcor
+{
+    /** Collects dirty element indices and merges them into ranges, so a buffer can be updated with a few large copies.
+        Ranges closer than the max gap are merged, uploading the few clean elements in between is cheaper than an extra copy.
+        Marking indices in increasing order is O(1) per index. Out-of-order marks are sorted and merged on getRanges().
+    */
+    class DirtyRangeTracker
+    {
+    public:
+        struct Range
+        {
+            uint32_t begin;
+            uint32_t end;   ///< One past the last dirty element.
+        };
+
+        DirtyRangeTracker(uint32_t maxGap = 0) : mMaxGap(maxGap) {}
+
+        void setMaxGap(uint32_t maxGap) { mMaxGap = maxGap; }
+
+        void mark(uint32_t index) { markRange(index, index + 1); }
+        void markRange(uint32_t begin, uint32_t end);
+
+        /** Get the merged dirty ranges, sorted by index.
+        */
+        const std::vector<Range>& getRanges();
+
+        /** Number of elements covered by the ranges, including merged clean elements.
+        */
+        uint32_t getElementCount();
+
+        /** Drop the dirty elements at or past the element count, e.g. when the array shrank after they were marked.
+        */
+        void clamp(uint32_t elementCount);
+
+        bool empty() const { return mRanges.empty(); }
+        void clear() { mRanges.clear(); mSorted = true; }
+
+        /** Check the merged ranges of fixed and random mark sequences against ranges computed from a per-element dirty mask.
+            Covers in-order and out-of-order marks, overlapping, adjacent and contained ranges, and merging across gaps.
+            \return True if all checks pass. Failures are logged.
+        */
+        static bool runSelfCheck();
+
+    private:
+        uint32_t mMaxGap;
+        bool mSorted = true;
+        std::vector<Range> mRanges;
+    };
+}
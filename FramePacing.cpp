@@ -0,0 +1,78 @@
+/***************************************************************************
+ # Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "stdafx.h"
+#include "FramePacing.h"
+
+namespace Mogwai
+{
+    FramePacing::FramePacing()
+    {
+        for (auto& pTimer : mpGpuTimers) pTimer = GpuTimer::create();
+    }
+
+    void FramePacing::beginFrame()
+    {
+        if (!mEnabled) return;
+
+        mPrevFrameStart = mFrameStart;
+        mFrameStart = Clock::now();
+        mpGpuTimers[mFrameIndex % kTimerCount]->begin();
+    }
+
+    void FramePacing::endFrame()
+    {
+        if (!mEnabled) return;
+
+        mpGpuTimers[mFrameIndex % kTimerCount]->end();
+        double cpuMs = std::chrono::duration<double, std::milli>(Clock::now() - mFrameStart).count();
+
+        // The oldest timer belongs to a frame the GPU has finished
+        if (mFrameIndex >= kTimerCount)
+        {
+            mSums.frames++;
+            mSums.intervalMs += std::chrono::duration<double, std::milli>(mFrameStart - mPrevFrameStart).count();
+            mSums.cpuMs += cpuMs;
+            mSums.gpuMs += mpGpuTimers[(mFrameIndex + 1) % kTimerCount]->getElapsedTime();
+        }
+        mFrameIndex++;
+
+        if (mSums.frames == mReportInterval)
+        {
+            double interval = mSums.intervalMs / mSums.frames;
+            double cpu = mSums.cpuMs / mSums.frames;
+            double gpu = mSums.gpuMs / mSums.frames;
+
+            // 0% when the interval is the sum of CPU and GPU time, 100% when it is the larger of the two
+            double overlap = std::min(cpu, gpu) > 0 ? glm::clamp((cpu + gpu - interval) / std::min(cpu, gpu), 0.0, 1.0) : 0.0;
+
+            logInfo("Frame pacing over " + std::to_string(mSums.frames) + " frames: interval " + std::to_string(interval) + " ms, CPU " + std::to_string(cpu)
+                + " ms, GPU " + std::to_string(gpu) + " ms, overlap " + std::to_string((int)(overlap * 100.0)) + "%");
+            mSums = {};
+        }
+    }
+}
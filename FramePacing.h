@@ -0,0 +1,74 @@
+/***************************************************************************
+ # Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#pragma once
+#include <chrono>
+
+namespace Mogwai
+{
+    using namespace Falcor;
+
+    /** Measures how much CPU frame recording and GPU execution overlap.
+        If they run serially the frame interval is close to CPU time + GPU time, with full overlap it is close to the larger of the two.
+        GPU times are read a few frames late so the measurement itself never waits for the GPU.
+    */
+    class FramePacing
+    {
+    public:
+        FramePacing();
+
+        void setEnabled(bool enabled) { mEnabled = enabled; mFrameIndex = 0; mSums = {}; }
+        bool isEnabled() const { return mEnabled; }
+
+        /** Set the number of frames averaged per report.
+        */
+        void setReportInterval(uint32_t frames) { mReportInterval = std::max(frames, 1u); }
+
+        void beginFrame();
+        void endFrame();
+
+    private:
+        using Clock = std::chrono::high_resolution_clock;
+        static const uint32_t kTimerCount = 4;  // Larger than the number of frames in flight
+
+        bool mEnabled = false;
+        uint32_t mReportInterval = 120;
+
+        GpuTimer::SharedPtr mpGpuTimers[kTimerCount];
+        uint64_t mFrameIndex = 0;
+        Clock::time_point mFrameStart;
+        Clock::time_point mPrevFrameStart;
+
+        struct
+        {
+            uint32_t frames = 0;
+            double intervalMs = 0;
+            double cpuMs = 0;
+            double gpuMs = 0;
+        } mSums;
+    };
+}
@@ -0,0 +1,254 @@
+/***************************************************************************
+ # Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "stdafx.h"
+#include "FrustumCulling.h"
+#include <random>
+
+namespace Falcor
+{
+    namespace FrustumCulling
+    {
+        namespace
+        {
+            // Reference for isVisible(): the box is outside if all eight corners are behind one plane
+            bool isVisibleReference(const Frustum& frustum, const float3& minPos, const float3& maxPos)
+            {
+                for (const auto& p : frustum.planes)
+                {
+                    bool outside = true;
+                    for (uint32_t i = 0; i < 8 && outside; i++)
+                    {
+                        float3 corner((i & 1) ? maxPos.x : minPos.x, (i & 2) ? maxPos.y : minPos.y, (i & 4) ? maxPos.z : minPos.z);
+                        outside = glm::dot(float3(p), corner) + p.w < 0;
+                    }
+                    if (outside) return false;
+                }
+                return true;
+            }
+
+            std::string toString(const float3& v)
+            {
+                return "(" + std::to_string(v.x) + ", " + std::to_string(v.y) + ", " + std::to_string(v.z) + ")";
+            }
+        }
+
+        Frustum extractFrustum(const glm::mat4& viewProj)
+        {
+            // glm matrices are column-major, row i is (m[0][i], m[1][i], m[2][i], m[3][i])
+            auto row = [&](int i) { return float4(viewProj[0][i], viewProj[1][i], viewProj[2][i], viewProj[3][i]); };
+
+            Frustum f;
+            f.planes[0] = row(3) + row(0);  // Left
+            f.planes[1] = row(3) - row(0);  // Right
+            f.planes[2] = row(3) + row(1);  // Bottom
+            f.planes[3] = row(3) - row(1);  // Top
+            f.planes[4] = row(2);           // Near
+            f.planes[5] = row(3) - row(2);  // Far
+
+            for (auto& p : f.planes) p /= glm::length(float3(p));
+            return f;
+        }
+
+        bool isVisible(const Frustum& frustum, const float3& minPos, const float3& maxPos)
+        {
+            // Test the corner furthest along each plane normal, the box is outside if even that corner is behind the plane
+            for (const auto& p : frustum.planes)
+            {
+                float3 corner(p.x > 0 ? maxPos.x : minPos.x, p.y > 0 ? maxPos.y : minPos.y, p.z > 0 ? maxPos.z : minPos.z);
+                if (glm::dot(float3(p), corner) + p.w < 0) return false;
+            }
+            return true;
+        }
+
+        uint32_t getViewMask(const std::vector<Frustum>& frustums, const float3& minPos, const float3& maxPos)
+        {
+            assert(frustums.size() <= kMaxViews);
+            uint32_t mask = 0;
+            for (uint32_t view = 0; view < (uint32_t)frustums.size(); view++)
+            {
+                if (isVisible(frustums[view], minPos, maxPos)) mask |= 1u << view;
+            }
+            return mask;
+        }
+
+        std::vector<D3D12_DRAW_INDEXED_ARGUMENTS> cull(const std::vector<Frustum>& frustums, const std::vector<D3D12_DRAW_INDEXED_ARGUMENTS>& draws, const std::vector<float4>& instanceBounds, std::vector<uint32_t>& viewMasks)
+        {
+            std::vector<D3D12_DRAW_INDEXED_ARGUMENTS> visible;
+            viewMasks.resize(instanceBounds.size() / 2);
+            for (const auto& draw : draws)
+            {
+                uint32_t instanceID = draw.StartInstanceLocation;
+                assert(2 * instanceID + 1 < instanceBounds.size());
+                viewMasks[instanceID] = getViewMask(frustums, float3(instanceBounds[2 * instanceID]), float3(instanceBounds[2 * instanceID + 1]));
+                if (viewMasks[instanceID] == 0) continue;
+
+                visible.push_back(draw);
+                visible.back().InstanceCount = (uint32_t)frustums.size();
+            }
+            return visible;
+        }
+
+        bool runSelfCheck()
+        {
+            bool success = true;
+            auto check = [&](const std::string& name, bool result, bool expected)
+            {
+                if (result != expected) logError("FrustumCulling self-check '" + name + "' failed: got " + (result ? "visible" : "culled") + ", expected " + (expected ? "visible" : "culled"));
+                success = success && result == expected;
+            };
+
+            // Fixed boxes against a 90 degree frustum at the origin, looking down -z, with near and far planes at 1 and 100
+            struct Case
+            {
+                std::string name;
+                float3 minPos;
+                float3 maxPos;
+                bool visible;
+            };
+            const Case kCases[] =
+            {
+                { "inside", float3(-1, -1, -11), float3(1, 1, -9), true },
+                { "containing the frustum", float3(-1000), float3(1000), true },
+                { "behind the camera", float3(-1, -1, 5), float3(1, 1, 6), false },
+                { "past the far plane", float3(-1, -1, -200), float3(1, 1, -150), false },
+                { "left of the frustum", float3(-100, -1, -11), float3(-90, 1, -9), false },
+                { "above the frustum", float3(-1, 90, -11), float3(1, 100, -9), false },
+                { "straddling the left plane", float3(-12, -1, -11), float3(-8, 1, -9), true },
+                { "straddling the top plane", float3(-1, 8, -11), float3(1, 12, -9), true },
+                { "straddling the near plane", float3(-0.5f, -0.5f, -2), float3(0.5f, 0.5f, 0.5f), true },
+                { "straddling the far plane", float3(-1, -1, -110), float3(1, 1, -90), true },
+            };
+
+            Frustum frustum = extractFrustum(glm::perspectiveRH_ZO(glm::radians(90.f), 1.f, 1.f, 100.f));
+            for (const auto& c : kCases) check(c.name, isVisible(frustum, c.minPos, c.maxPos), c.visible);
+
+            // Random boxes against random frustums, and a draw list culled against each frustum
+            std::mt19937 rng(1234);
+            std::uniform_real_distribution<float> coord(-50.f, 50.f);
+            std::uniform_real_distribution<float> extent(0.f, 10.f);
+            auto randomFrustum = [&]()
+            {
+                glm::mat4 view = glm::lookAtRH(float3(coord(rng), coord(rng), coord(rng)), float3(coord(rng), coord(rng), coord(rng)), float3(0, 1, 0));
+                glm::mat4 proj = glm::perspectiveRH_ZO(glm::radians(30.f + extent(rng) * 10.f), 0.5f + extent(rng) * 0.2f, 0.1f, 20.f + extent(rng) * 10.f);
+                return extractFrustum(proj * view);
+            };
+            for (uint32_t iteration = 0; iteration < 100 && success; iteration++)
+            {
+                std::vector<Frustum> frustums = { randomFrustum() };
+
+                const uint32_t kInstanceCount = 256;
+                std::vector<float4> instanceBounds(2 * kInstanceCount);
+                std::vector<D3D12_DRAW_INDEXED_ARGUMENTS> draws;
+                std::vector<D3D12_DRAW_INDEXED_ARGUMENTS> expectedDraws;
+                for (uint32_t instanceID = 0; instanceID < kInstanceCount; instanceID++)
+                {
+                    float3 minPos(coord(rng), coord(rng), coord(rng));
+                    float3 maxPos = minPos + float3(extent(rng), extent(rng), extent(rng));
+                    instanceBounds[2 * instanceID] = float4(minPos, 0.f);
+                    instanceBounds[2 * instanceID + 1] = float4(maxPos, 0.f);
+
+                    bool expected = isVisibleReference(frustums[0], minPos, maxPos);
+                    check("random box " + toString(minPos) + " - " + toString(maxPos) + " in frustum " + std::to_string(iteration), isVisible(frustums[0], minPos, maxPos), expected);
+
+                    // Every other instance is drawn, so cull() also has to skip bounds that no draw references
+                    if (instanceID % 2) continue;
+                    D3D12_DRAW_INDEXED_ARGUMENTS draw = {};
+                    draw.IndexCountPerInstance = 3 * (instanceID + 1);
+                    draw.InstanceCount = 1;
+                    draw.StartInstanceLocation = instanceID;
+                    draws.push_back(draw);
+                    if (expected) expectedDraws.push_back(draw);
+                }
+
+                std::vector<uint32_t> viewMasks;
+                auto visible = cull(frustums, draws, instanceBounds, viewMasks);
+                bool match = visible.size() == expectedDraws.size();
+                for (size_t i = 0; i < visible.size() && match; i++)
+                {
+                    match = visible[i].StartInstanceLocation == expectedDraws[i].StartInstanceLocation && visible[i].IndexCountPerInstance == expectedDraws[i].IndexCountPerInstance && visible[i].InstanceCount == 1;
+                }
+                if (!match) logError("FrustumCulling self-check failed: cull() kept " + std::to_string(visible.size()) + " draws of frustum " + std::to_string(iteration) + ", expected " + std::to_string(expectedDraws.size()));
+                success = success && match;
+            }
+
+            // Multi-view: random view sets, as used for cube faces or cascades. Bit i of a view mask must match the reference test against view i,
+            // and cull() must keep the draws visible in any view, with one instance per view, and report the same masks.
+            for (uint32_t iteration = 0; iteration < 100 && success; iteration++)
+            {
+                std::vector<Frustum> frustums(1 + rng() % kMaxViews);
+                for (auto& f : frustums) f = randomFrustum();
+
+                const uint32_t kInstanceCount = 256;
+                std::vector<float4> instanceBounds(2 * kInstanceCount);
+                std::vector<uint32_t> expectedMasks(kInstanceCount);
+                std::vector<D3D12_DRAW_INDEXED_ARGUMENTS> draws;
+                for (uint32_t instanceID = 0; instanceID < kInstanceCount; instanceID++)
+                {
+                    float3 minPos(coord(rng), coord(rng), coord(rng));
+                    float3 maxPos = minPos + float3(extent(rng), extent(rng), extent(rng));
+                    instanceBounds[2 * instanceID] = float4(minPos, 0.f);
+                    instanceBounds[2 * instanceID + 1] = float4(maxPos, 0.f);
+                    for (uint32_t view = 0; view < (uint32_t)frustums.size(); view++)
+                    {
+                        if (isVisibleReference(frustums[view], minPos, maxPos)) expectedMasks[instanceID] |= 1u << view;
+                    }
+
+                    uint32_t mask = getViewMask(frustums, minPos, maxPos);
+                    if (mask != expectedMasks[instanceID])
+                    {
+                        logError("FrustumCulling self-check failed: view mask " + std::to_string(mask) + " of random box " + toString(minPos) + " - " + toString(maxPos) + " in view set " + std::to_string(iteration) + ", expected " + std::to_string(expectedMasks[instanceID]));
+                        success = false;
+                    }
+
+                    D3D12_DRAW_INDEXED_ARGUMENTS draw = {};
+                    draw.IndexCountPerInstance = 3;
+                    draw.InstanceCount = 1;
+                    draw.StartInstanceLocation = instanceID;
+                    draws.push_back(draw);
+                }
+
+                std::vector<uint32_t> viewMasks;
+                auto visible = cull(frustums, draws, instanceBounds, viewMasks);
+                size_t next = 0;
+                bool match = viewMasks == expectedMasks;
+                for (uint32_t instanceID = 0; instanceID < kInstanceCount && match; instanceID++)
+                {
+                    if (expectedMasks[instanceID] == 0) continue;
+                    match = next < visible.size() && visible[next].StartInstanceLocation == instanceID && visible[next].InstanceCount == (uint32_t)frustums.size();
+                    next++;
+                }
+                match = match && next == visible.size();
+                if (!match) logError("FrustumCulling self-check failed: cull() doesn't match the view masks of view set " + std::to_string(iteration) + " with " + std::to_string(frustums.size()) + " views");
+                success = success && match;
+            }
+
+            if (success) logInfo("FrustumCulling self-check passed");
+            return success;
+        }
+    }
+}
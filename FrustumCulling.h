@@ -0,0 +1,71 @@
+/***************************************************************************
+ # Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#pragma once
+
+namespace Falcor
+{
+    /** Frustum tests for instance bounds.
+        This is the CPU reference for the culling done on the GPU by SceneCulling.cs.slang. The two must stay in sync.
+    */
+    namespace FrustumCulling
+    {
+        static const uint32_t kMaxViews = 8;    ///< Views culled in one pass. Keep in sync with SceneCulling.cs.slang and MultiView.slang.
+
+        /** Frustum planes, stored as (normal, distance) with normals pointing inside.
+        */
+        struct Frustum
+        {
+            float4 planes[6];
+        };
+
+        /** Extract the frustum planes of a view-projection matrix, using D3D clip space (0 <= z <= w).
+        */
+        Frustum extractFrustum(const glm::mat4& viewProj);
+
+        /** Check if a box is at least partially inside the frustum. Boxes that intersect a plane near a frustum corner may be reported visible.
+        */
+        bool isVisible(const Frustum& frustum, const float3& minPos, const float3& maxPos);
+
+        /** Get the views a box is visible in, bit i is set if it is visible in frustums[i].
+        */
+        uint32_t getViewMask(const std::vector<Frustum>& frustums, const float3& minPos, const float3& maxPos);
+
+        /** Cull a draw list. Draws are matched to instance bounds by StartInstanceLocation, like the GPU pass does.
+            Visible draws get one instance per view.
+            \param[out] viewMasks The view mask of each instance referenced by the draws.
+            \return The visible draws, in their original order.
+        */
+        std::vector<D3D12_DRAW_INDEXED_ARGUMENTS> cull(const std::vector<Frustum>& frustums, const std::vector<D3D12_DRAW_INDEXED_ARGUMENTS>& draws, const std::vector<float4>& instanceBounds, std::vector<uint32_t>& viewMasks);
+
+        /** Check isVisible() on fixed boxes inside, outside and straddling the planes of a frustum, and on random boxes and frustums against a test of all eight box corners.
+            Also checks that cull() keeps exactly the visible draws, in order, and that getViewMask() and cull() agree with the reference for sets of up to kMaxViews views.
+            \return True if all checks pass. Failures are logged.
+        */
+        bool runSelfCheck();
+    }
+}
@@ -0,0 +1,247 @@
+/***************************************************************************
+ # Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "stdafx.h"
+#include "InstanceBoundsCache.h"
+#include "ParallelFor.h"
+#include "TransformKernels.h"
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <xmmintrin.h>
+
+namespace Falcor
+{
+    namespace
+    {
+        const size_t kReduceBatchSize = 1 << 16;    // Instances per thread, below this the reduction runs inline.
+        const size_t kTransformBatchSize = 1 << 14; // Instances per thread in the benchmark's transform step, same as Scene.
+
+        // Reduces [begin, end) four instances at a time.
+        void reduceRange(const float* pMin, const float* pMax, size_t begin, size_t end, float& outMin, float& outMax)
+        {
+            __m128 vMin = _mm_set1_ps(FLT_MAX);
+            __m128 vMax = _mm_set1_ps(-FLT_MAX);
+            size_t i = begin;
+            for (; i + 4 <= end; i += 4)
+            {
+                vMin = _mm_min_ps(vMin, _mm_loadu_ps(pMin + i));
+                vMax = _mm_max_ps(vMax, _mm_loadu_ps(pMax + i));
+            }
+
+            alignas(16) float lanesMin[4], lanesMax[4];
+            _mm_store_ps(lanesMin, vMin);
+            _mm_store_ps(lanesMax, vMax);
+            outMin = std::min(std::min(lanesMin[0], lanesMin[1]), std::min(lanesMin[2], lanesMin[3]));
+            outMax = std::max(std::max(lanesMax[0], lanesMax[1]), std::max(lanesMax[2], lanesMax[3]));
+
+            for (; i < end; i++)
+            {
+                outMin = std::min(outMin, pMin[i]);
+                outMax = std::max(outMax, pMax[i]);
+            }
+        }
+    }
+
+    void InstanceBoundsCache::resize(size_t instanceCount)
+    {
+        for (uint32_t c = 0; c < 3; c++)
+        {
+            mMin[c].resize(instanceCount, FLT_MAX);
+            mMax[c].resize(instanceCount, -FLT_MAX);
+        }
+    }
+
+    void InstanceBoundsCache::set(size_t index, const BoundingBox& bb)
+    {
+        assert(index < size());
+        float3 minPos = bb.getMinPos();
+        float3 maxPos = bb.getMaxPos();
+        for (uint32_t c = 0; c < 3; c++)
+        {
+            mMin[c][index] = minPos[c];
+            mMax[c][index] = maxPos[c];
+        }
+    }
+
+    void InstanceBoundsCache::setTransformed(const glm::mat4* pMatrices, const BoundingBox* pLocalBounds, const uint32_t* pMatrixIDs, const uint32_t* pBoundsIDs, const uint32_t* pIndices, size_t count)
+    {
+        float* const pMin[3] = { mMin[0].data(), mMin[1].data(), mMin[2].data() };
+        float* const pMax[3] = { mMax[0].data(), mMax[1].data(), mMax[2].data() };
+        TransformKernels::transformBounds(pMatrices, pLocalBounds, pMatrixIDs, pBoundsIDs, pIndices, count, pMin, pMax);
+    }
+
+    BoundingBox InstanceBoundsCache::get(size_t index) const
+    {
+        assert(index < size());
+        return BoundingBox::fromMinMax(float3(mMin[0][index], mMin[1][index], mMin[2][index]), float3(mMax[0][index], mMax[1][index], mMax[2][index]));
+    }
+
+    void InstanceBoundsCache::pack(float4* pDst, size_t begin, size_t end) const
+    {
+        assert(begin <= end && end <= size());
+        for (size_t i = begin; i < end; i++)
+        {
+            *pDst++ = float4(mMin[0][i], mMin[1][i], mMin[2][i], 0.f);
+            *pDst++ = float4(mMax[0][i], mMax[1][i], mMax[2][i], 0.f);
+        }
+    }
+
+    BoundingBox InstanceBoundsCache::reduce() const
+    {
+        float3 sceneMin = float3(FLT_MAX);
+        float3 sceneMax = float3(-FLT_MAX);
+        std::mutex mutex;
+
+        parallelFor(size(), kReduceBatchSize, [&](size_t begin, size_t end)
+        {
+            float3 localMin, localMax;
+            for (uint32_t c = 0; c < 3; c++) reduceRange(mMin[c].data(), mMax[c].data(), begin, end, localMin[c], localMax[c]);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            sceneMin = glm::min(sceneMin, localMin);
+            sceneMax = glm::max(sceneMax, localMax);
+        });
+
+        if (sceneMin.x > sceneMax.x) return BoundingBox();
+        return BoundingBox::fromMinMax(sceneMin, sceneMax);
+    }
+
+    bool InstanceBoundsCache::runBenchmark(uint32_t instanceCount)
+    {
+        const uint32_t kFrameCount = 8;
+        const float kDirtyFractions[] = { 0.001f, 0.01f, 0.1f, 1.f };
+
+        // Random instances, several per matrix and mesh like in scenes with instanced meshes
+        std::mt19937 rng(1234);
+        std::uniform_real_distribution<float> coord(-100.f, 100.f);
+        std::uniform_real_distribution<float> scale(0.1f, 4.f);
+        std::uniform_real_distribution<float> unit(0.f, 1.f);
+        auto randomMatrix = [&]()
+        {
+            glm::mat4 m = glm::translate(glm::identity<glm::mat4>(), float3(coord(rng), coord(rng), coord(rng)));
+            return glm::scale(m, float3(scale(rng), scale(rng), scale(rng)));
+        };
+
+        uint32_t matrixCount = std::max(instanceCount / 2, 1u);
+        uint32_t meshCount = std::max(instanceCount / 4, 1u);
+        std::vector<glm::mat4> matrices(matrixCount);
+        for (auto& m : matrices) m = randomMatrix();
+
+        std::vector<BoundingBox> meshBounds(meshCount);
+        for (auto& bb : meshBounds)
+        {
+            float3 c(coord(rng), coord(rng), coord(rng));
+            bb = BoundingBox::fromMinMax(c - float3(scale(rng)), c + float3(scale(rng)));
+        }
+
+        std::vector<uint32_t> matrixIDs(instanceCount), meshIDs(instanceCount);
+        for (uint32_t i = 0; i < instanceCount; i++)
+        {
+            matrixIDs[i] = rng() % matrixCount;
+            meshIDs[i] = rng() % meshCount;
+        }
+
+        using Clock = std::chrono::high_resolution_clock;
+        auto ms = [](Clock::time_point t0) { return std::chrono::duration<double, std::milli>(Clock::now() - t0).count(); };
+
+        // The first update transforms everything, as Scene does on the first frame
+        InstanceBoundsCache cache;
+        cache.resize(instanceCount);
+        for (uint32_t i = 0; i < instanceCount; i++) cache.set(i, meshBounds[meshIDs[i]].transform(matrices[matrixIDs[i]]));
+
+        InstanceBoundsCache simdCache;
+        simdCache.resize(instanceCount);
+        std::vector<uint32_t> allIndices(instanceCount);
+        for (uint32_t i = 0; i < instanceCount; i++) allIndices[i] = i;
+        simdCache.setTransformed(matrices.data(), meshBounds.data(), matrixIDs.data(), meshIDs.data(), allIndices.data(), instanceCount);
+
+        bool match = true;
+        std::vector<uint8_t> changed(matrixCount);
+        for (float fraction : kDirtyFractions)
+        {
+            double fullMs = 0, incrementalMs = 0, simdMs = 0;
+            for (uint32_t frame = 0; frame < kFrameCount; frame++)
+            {
+                for (uint32_t m = 0; m < matrixCount; m++)
+                {
+                    changed[m] = unit(rng) < fraction;
+                    if (changed[m]) matrices[m] = randomMatrix();
+                }
+
+                // Full recompute, what Scene::updateBounds() did before the cache
+                auto t0 = Clock::now();
+                BoundingBox fullBounds = meshBounds[meshIDs[0]].transform(matrices[matrixIDs[0]]);
+                for (uint32_t i = 1; i < instanceCount; i++) fullBounds = BoundingBox::fromUnion(fullBounds, meshBounds[meshIDs[i]].transform(matrices[matrixIDs[i]]));
+                fullMs += ms(t0);
+
+                // Incremental path, same as Scene::updateBounds()
+                t0 = Clock::now();
+                parallelFor(instanceCount, kTransformBatchSize, [&](size_t begin, size_t end)
+                {
+                    for (size_t i = begin; i < end; i++)
+                    {
+                        if (changed[matrixIDs[i]]) cache.set(i, meshBounds[meshIDs[i]].transform(matrices[matrixIDs[i]]));
+                    }
+                });
+                BoundingBox cachedBounds = cache.reduce();
+                incrementalMs += ms(t0);
+
+                // Incremental path with the SIMD transform, same as Scene::updateBounds()
+                t0 = Clock::now();
+                parallelFor(instanceCount, kTransformBatchSize, [&](size_t begin, size_t end)
+                {
+                    std::vector<uint32_t> indices;
+                    indices.reserve(end - begin);
+                    for (size_t i = begin; i < end; i++)
+                    {
+                        if (changed[matrixIDs[i]]) indices.push_back((uint32_t)i);
+                    }
+                    simdCache.setTransformed(matrices.data(), meshBounds.data(), matrixIDs.data(), meshIDs.data(), indices.data(), indices.size());
+                });
+                BoundingBox simdBounds = simdCache.reduce();
+                simdMs += ms(t0);
+
+                // BoundingBox stores center and extent, so repeated unions round differently than the min/max reduction.
+                // The SIMD transform also uses a different order of operations than BoundingBox::transform().
+                float tolerance = 1e-4f * (1.f + glm::length(fullBounds.getMaxPos() - fullBounds.getMinPos()));
+                auto matchesFull = [&](const BoundingBox& bb)
+                {
+                    return glm::all(glm::lessThanEqual(glm::abs(bb.getMinPos() - fullBounds.getMinPos()), float3(tolerance)))
+                        && glm::all(glm::lessThanEqual(glm::abs(bb.getMaxPos() - fullBounds.getMaxPos()), float3(tolerance)));
+                };
+                match = match && matchesFull(cachedBounds) && matchesFull(simdBounds);
+            }
+
+            logInfo("InstanceBoundsCache benchmark, " + std::to_string(instanceCount) + " instances, " + std::to_string(fraction * 100.f) + "% of transforms changed: full recompute "
+                + std::to_string(fullMs / kFrameCount) + " ms, incremental " + std::to_string(incrementalMs / kFrameCount) + " ms, incremental SIMD " + std::to_string(simdMs / kFrameCount) + " ms per frame");
+        }
+
+        if (!match) logError("InstanceBoundsCache: the incremental scene bounds don't match the full recompute");
+        return match;
+    }
+}
@@ -0,0 +1,76 @@
+/***************************************************************************
+ # Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#pragma once
+
+namespace Falcor
+{
+    /** World-space bounds of every mesh instance, stored as structure-of-arrays so they can be reduced with SIMD.
+        Scene only rewrites the entries of instances whose transform changed and then reduces the whole array.
+    */
+    class InstanceBoundsCache
+    {
+    public:
+        /** Resize the cache. Existing entries are kept, new entries are empty.
+        */
+        void resize(size_t instanceCount);
+
+        size_t size() const { return mMin[0].size(); }
+
+        /** Set the world-space bounds of an instance. Different indices can be set concurrently.
+        */
+        void set(size_t index, const BoundingBox& bb);
+
+        /** Set the world-space bounds of a list of instances by transforming their local bounds with SIMD. Different indices can be set concurrently.
+            \param[in] pMatrixIDs Matrix of each instance.
+            \param[in] pBoundsIDs Local bounds of each instance.
+            \param[in] pIndices Instances to set.
+        */
+        void setTransformed(const glm::mat4* pMatrices, const BoundingBox* pLocalBounds, const uint32_t* pMatrixIDs, const uint32_t* pBoundsIDs, const uint32_t* pIndices, size_t count);
+
+        /** Get the world-space bounds of an instance.
+        */
+        BoundingBox get(size_t index) const;
+
+        /** Write the bounds of the instances in [begin, end) as interleaved min and max positions, two float4 per instance. This is the layout the GPU culling pass reads.
+        */
+        void pack(float4* pDst, size_t begin, size_t end) const;
+
+        /** Compute the union of all instance bounds. Large arrays are split across threads.
+        */
+        BoundingBox reduce() const;
+
+        /** Compare the incremental update (transform changed instances, then reduce) with scalar and SIMD transforms against recomputing every instance bound, for several fractions of changed transforms.
+            Logs the timings and returns false if the scene bounds differ.
+        */
+        static bool runBenchmark(uint32_t instanceCount);
+
+    private:
+        std::vector<float> mMin[3];
+        std::vector<float> mMax[3];
+    };
+}
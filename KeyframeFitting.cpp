@@ -0,0 +1,185 @@
+/***************************************************************************
+ # Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "stdafx.h"
+#include "KeyframeFitting.h"
+#include <chrono>
+#include <random>
+
+namespace Falcor
+{
+    namespace KeyframeFitting
+    {
+        namespace
+        {
+            const uint32_t kBenchmarkKeyCount = 100;    // Keys per channel, one per time unit like Mogwai's animations.
+            const uint32_t kBenchmarkSampleCount = 64;  // Evaluations per channel.
+            const size_t kMaxSegmentKeys = 64;          // Keys a segment may skip. Each extension rechecks the whole segment, so this bounds fitting to O(n * kMaxSegmentKeys).
+
+            float getRotationError(const glm::quat& a, const glm::quat& b)
+            {
+                float d = std::min(std::abs(glm::dot(a, b)), 1.f);
+                return 2.f * std::acos(d);
+            }
+
+            bool isWithinTolerance(const Animation::Keyframe& key, const Animation::Keyframe& approx, const Tolerance& tolerance)
+            {
+                float3 scalingError = glm::abs(key.scaling - approx.scaling);
+                return glm::length(key.translation - approx.translation) <= tolerance.translation
+                    && std::max(scalingError.x, std::max(scalingError.y, scalingError.z)) <= tolerance.scaling
+                    && getRotationError(key.rotation, approx.rotation) <= tolerance.rotation;
+            }
+
+            // Checks that interpolating keys[first] and keys[last] reproduces every key between them.
+            // The loop runs backwards: when a segment is extended, the key it newly skips is the most likely to fail.
+            bool isSegmentValid(const std::vector<Animation::Keyframe>& keys, size_t first, size_t last, const Tolerance& tolerance)
+            {
+                for (size_t i = last - 1; i > first; i--)
+                {
+                    if (!isWithinTolerance(keys[i], interpolate(keys[first], keys[last], keys[i].time), tolerance)) return false;
+                }
+                return true;
+            }
+        }
+
+        Animation::Keyframe interpolate(const Animation::Keyframe& a, const Animation::Keyframe& b, float time)
+        {
+            float t = b.time > a.time ? (time - a.time) / (b.time - a.time) : 0.f;
+            Animation::Keyframe result;
+            result.time = time;
+            result.translation = glm::mix(a.translation, b.translation, t);
+            result.scaling = glm::mix(a.scaling, b.scaling, t);
+            result.rotation = glm::slerp(a.rotation, b.rotation, t);
+            return result;
+        }
+
+        Animation::Keyframe evaluate(const std::vector<Animation::Keyframe>& keys, float time)
+        {
+            assert(!keys.empty());
+            if (time <= keys.front().time) return keys.front();
+            if (time >= keys.back().time) return keys.back();
+
+            auto next = std::upper_bound(keys.begin(), keys.end(), time, [](float t, const Animation::Keyframe& key) { return t < key.time; });
+            return interpolate(*(next - 1), *next, time);
+        }
+
+        std::vector<Animation::Keyframe> fit(const std::vector<Animation::Keyframe>& keys, const Tolerance& tolerance)
+        {
+            if (keys.size() <= 2) return keys;
+
+            std::vector<Animation::Keyframe> result;
+            size_t first = 0;
+            result.push_back(keys[first]);
+            while (first < keys.size() - 1)
+            {
+                // Extend the segment while it reproduces the keys it skips. A segment to the next key is always valid.
+                // Moving the end key changes the interpolation of every skipped key, so each extension has to recheck all of them.
+                size_t last = first + 1;
+                while (last + 1 < keys.size() && last - first < kMaxSegmentKeys && isSegmentValid(keys, first, last + 1, tolerance)) last++;
+                result.push_back(keys[last]);
+                first = last;
+            }
+            return result;
+        }
+
+        bool runBenchmark(uint32_t channelCount)
+        {
+            // Channels built like Mogwai's addKeyframes(): constant scale, constant rotation speed and a periodic translation
+            std::mt19937 rng(1234);
+            std::uniform_real_distribution<float> unit(0.f, 1.f);
+            std::vector<std::vector<Animation::Keyframe>> channels(channelCount);
+            for (auto& keys : channels)
+            {
+                float scale = 0.5f + unit(rng);
+                float rotSpeed = 0.2f * unit(rng);
+                float3 axis = glm::normalize(float3(unit(rng), unit(rng), unit(rng)) + float3(0.1f));
+                float3 tranSpeed = float3(unit(rng), unit(rng), unit(rng));
+
+                keys.resize(kBenchmarkKeyCount);
+                for (uint32_t i = 0; i < kBenchmarkKeyCount; i++)
+                {
+                    float phase = 6.2831853f * i / kBenchmarkKeyCount;
+                    keys[i].time = float(i);
+                    keys[i].scaling = float3(scale);
+                    keys[i].rotation = glm::angleAxis(rotSpeed * i, axis);
+                    keys[i].translation = float3(std::sin(phase), std::cos(phase), std::cos(phase)) * tranSpeed;
+                }
+            }
+
+            using Clock = std::chrono::high_resolution_clock;
+            auto ms = [](Clock::time_point t0) { return std::chrono::duration<double, std::milli>(Clock::now() - t0).count(); };
+
+            Tolerance tolerance;
+            auto t0 = Clock::now();
+            std::vector<std::vector<Animation::Keyframe>> fitted(channelCount);
+            size_t fittedKeyCount = 0;
+            for (uint32_t c = 0; c < channelCount; c++)
+            {
+                fitted[c] = fit(channels[c], tolerance);
+                fittedKeyCount += fitted[c].size();
+            }
+            double fitMs = ms(t0);
+
+            // Evaluate every channel at the same times, like a frame does. The checksum keeps the evaluations from being optimized out.
+            std::vector<float> sampleTimes(kBenchmarkSampleCount);
+            for (uint32_t s = 0; s < kBenchmarkSampleCount; s++) sampleTimes[s] = (kBenchmarkKeyCount - 1) * (s + 0.5f) / kBenchmarkSampleCount;
+
+            auto evaluateAll = [&](const std::vector<std::vector<Animation::Keyframe>>& source, double& outMs)
+            {
+                float checksum = 0.f;
+                auto start = Clock::now();
+                for (float time : sampleTimes)
+                {
+                    for (const auto& keys : source) checksum += evaluate(keys, time).translation.x;
+                }
+                outMs = ms(start) / kBenchmarkSampleCount;
+                return checksum;
+            };
+            double denseMs = 0.0, sparseMs = 0.0;
+            float denseChecksum = evaluateAll(channels, denseMs);
+            float sparseChecksum = evaluateAll(fitted, sparseMs);
+
+            // The tolerance is checked at the input keys. Check it between them too, with a margin for the curvature between keys.
+            bool withinTolerance = true;
+            Tolerance margin = tolerance;
+            margin.translation *= 2.f;
+            margin.rotation *= 2.f;
+            margin.scaling *= 2.f;
+            for (uint32_t c = 0; c < channelCount && withinTolerance; c++)
+            {
+                for (float time : sampleTimes) withinTolerance = withinTolerance && isWithinTolerance(evaluate(channels[c], time), evaluate(fitted[c], time), margin);
+            }
+
+            logInfo("KeyframeFitting benchmark, " + std::to_string(channelCount) + " channels: " + std::to_string(size_t(channelCount) * kBenchmarkKeyCount) + " keys fitted to "
+                + std::to_string(fittedKeyCount) + " in " + std::to_string(fitMs) + " ms; evaluating all channels takes " + std::to_string(denseMs) + " ms dense, "
+                + std::to_string(sparseMs) + " ms sparse (checksums " + std::to_string(denseChecksum) + ", " + std::to_string(sparseChecksum) + "), "
+                + (withinTolerance ? "within tolerance" : "NOT WITHIN TOLERANCE"));
+            if (!withinTolerance) logError("KeyframeFitting: the fitted channels don't stay within the tolerance");
+            return withinTolerance;
+        }
+    }
+}
@@ -0,0 +1,67 @@
+/***************************************************************************
+ # Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#pragma once
+
+namespace Falcor
+{
+    /** Removes keyframes that the interpolation between their neighbors already reproduces within a tolerance.
+        Animations sampled at a fixed rate mostly hold keys on straight segments or constant rotations, so few keys remain.
+        Fewer keys make the keyframe search of every channel cheaper each frame.
+    */
+    namespace KeyframeFitting
+    {
+        /** Largest error allowed at the removed keys.
+        */
+        struct Tolerance
+        {
+            float translation = 5e-3f;  ///< Distance in scene units.
+            float scaling = 1e-3f;      ///< Absolute scale difference per axis.
+            float rotation = 2e-3f;     ///< Angle in radians.
+        };
+
+        /** Interpolate two keyframes the way Animation does: linearly for translation and scaling, spherically for rotation.
+        */
+        Animation::Keyframe interpolate(const Animation::Keyframe& a, const Animation::Keyframe& b, float time);
+
+        /** Evaluate a channel at a time within its keys, with a binary search for the segment.
+        */
+        Animation::Keyframe evaluate(const std::vector<Animation::Keyframe>& keys, float time);
+
+        /** Keep few keys such that interpolating them stays within the tolerance at every input key.
+            The first and last keys are always kept. Segments are extended greedily from each kept key and skip at most 64 keys, which keeps fitting linear in the key count.
+            \param[in] keys Keyframes sorted by time.
+            \return The kept keyframes.
+        */
+        std::vector<Animation::Keyframe> fit(const std::vector<Animation::Keyframe>& keys, const Tolerance& tolerance = {});
+
+        /** Fit synthetic channels like the ones Mogwai creates and log the key reduction, the fitting time and the evaluation time before and after.
+            \return True if the fitted channels stay within the tolerance.
+        */
+        bool runBenchmark(uint32_t channelCount);
+    }
+}
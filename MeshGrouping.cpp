@@ -0,0 +1,606 @@
+/***************************************************************************
+ # Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "stdafx.h"
+#include "MeshGrouping.h"
+#include <chrono>
+#include <limits>
+#include <random>
+
+namespace Falcor
+{
+    namespace MeshGrouping
+    {
+        namespace
+        {
+            // Fills the per-mesh instance ranges from the final instance order
+            void computeMeshRanges(Result& result, uint32_t meshCount, const std::vector<MeshInstanceData>& instances)
+            {
+                result.meshFirstInstance.assign(meshCount, 0);
+                result.meshInstanceCount.assign(meshCount, 0);
+                for (uint32_t i = (uint32_t)result.instanceOrder.size(); i-- > 0;)
+                {
+                    uint32_t meshID = instances[result.instanceOrder[i]].meshID;
+                    result.meshFirstInstance[meshID] = i;
+                    result.meshInstanceCount[meshID]++;
+                }
+            }
+
+            // Rebuilds the instance order of a grouping from the per-mesh instance ranges of the grouping it was derived from
+            void reorderInstances(Result& result, const Result& source)
+            {
+                result.meshInstanceCount = source.meshInstanceCount;
+                result.meshFirstInstance.assign(source.meshFirstInstance.size(), 0);
+                result.instanceOrder.resize(source.instanceOrder.size());
+                uint32_t next = 0;
+                for (uint32_t meshID : result.groupMeshes)
+                {
+                    result.meshFirstInstance[meshID] = next;
+                    for (uint32_t i = 0; i < source.meshInstanceCount[meshID]; i++) result.instanceOrder[next++] = source.instanceOrder[source.meshFirstInstance[meshID] + i];
+                }
+                assert(next == result.instanceOrder.size());
+            }
+
+            BoundingBox merge(const BoundingBox& a, const BoundingBox& b)
+            {
+                return BoundingBox::fromMinMax(glm::min(a.getMinPos(), b.getMinPos()), glm::max(a.getMaxPos(), b.getMaxPos()));
+            }
+
+            float getSurfaceArea(const BoundingBox& bb)
+            {
+                float3 e = bb.getMaxPos() - bb.getMinPos();
+                return 2.f * (e.x * e.y + e.y * e.z + e.z * e.x);
+            }
+
+            // Expected cost of descending into a BLAS once it's hit
+            float getBlasCost(uint64_t triangleCount, const CostModel& model)
+            {
+                return model.traversalCost * std::log2((float)std::max<uint64_t>(triangleCount, 1)) + model.intersectionCost;
+            }
+
+            // Mesh data used by the split, stored contiguously so the passes over a group don't jump around the mesh arrays
+            struct SplitItem
+            {
+                float3 minPos;
+                float3 maxPos;
+                float3 center;
+                uint32_t triangleCount;
+                uint32_t meshID;
+            };
+
+            struct Piece
+            {
+                uint32_t begin;     // Range of the piece in the group's item list
+                uint32_t end;
+                uint32_t mergedInto;
+                uint64_t triangleCount;
+                BoundingBox bounds;
+            };
+
+            /** Split the meshes of a group at the SAH-optimal plane, binned by centroid, until each piece fits the triangle budget.
+                The item list is reordered so each piece is a contiguous range of it.
+            */
+            std::vector<Piece> splitGroup(std::vector<SplitItem>& items, uint32_t maxTriangles)
+            {
+                const uint32_t kBinCount = 32;
+                static constexpr float kMaxFloat = std::numeric_limits<float>::max();
+
+                // Bounds are accumulated as min/max, which is cheaper than merging BoundingBoxes
+                struct Bin
+                {
+                    float3 minPos = float3(kMaxFloat);
+                    float3 maxPos = float3(-kMaxFloat);
+                    uint64_t triangleCount = 0;
+                };
+                auto getArea = [](const float3& minPos, const float3& maxPos)
+                {
+                    float3 e = maxPos - minPos;
+                    return 2.f * (e.x * e.y + e.y * e.z + e.z * e.x);
+                };
+
+                std::vector<Piece> pieces;
+                std::vector<std::pair<uint32_t, uint32_t>> stack = { { 0, (uint32_t)items.size() } };
+
+                while (!stack.empty())
+                {
+                    auto [begin, end] = stack.back();
+                    stack.pop_back();
+
+                    uint64_t triangleCount = 0;
+                    float3 minPos(kMaxFloat), maxPos(-kMaxFloat);
+                    float3 centerMin(kMaxFloat), centerMax(-kMaxFloat);
+                    for (uint32_t i = begin; i < end; i++)
+                    {
+                        const SplitItem& item = items[i];
+                        triangleCount += item.triangleCount;
+                        minPos = glm::min(minPos, item.minPos);
+                        maxPos = glm::max(maxPos, item.maxPos);
+                        centerMin = glm::min(centerMin, item.center);
+                        centerMax = glm::max(centerMax, item.center);
+                    }
+
+                    if (end - begin == 1 || triangleCount <= maxTriangles)
+                    {
+                        pieces.push_back({ begin, end, (uint32_t)pieces.size(), triangleCount, BoundingBox::fromMinMax(minPos, maxPos) });
+                        continue;
+                    }
+
+                    // A split costs area * triangles of both sides. Planes are evaluated between bins on each axis.
+                    float bestCost = kMaxFloat;
+                    uint32_t bestAxis = 0;
+                    uint32_t bestBin = 0;
+                    for (uint32_t axis = 0; axis < 3; axis++)
+                    {
+                        float extent = centerMax[axis] - centerMin[axis];
+                        if (extent <= 0.f) continue;
+
+                        Bin bins[kBinCount];
+                        for (uint32_t i = begin; i < end; i++)
+                        {
+                            const SplitItem& item = items[i];
+                            Bin& bin = bins[std::min((uint32_t)((item.center[axis] - centerMin[axis]) / extent * kBinCount), kBinCount - 1)];
+                            bin.minPos = glm::min(bin.minPos, item.minPos);
+                            bin.maxPos = glm::max(bin.maxPos, item.maxPos);
+                            bin.triangleCount += item.triangleCount;
+                        }
+
+                        float rightCost[kBinCount] = {};
+                        Bin right;
+                        for (uint32_t b = kBinCount - 1; b > 0; b--)
+                        {
+                            right.minPos = glm::min(right.minPos, bins[b].minPos);
+                            right.maxPos = glm::max(right.maxPos, bins[b].maxPos);
+                            right.triangleCount += bins[b].triangleCount;
+                            rightCost[b] = right.triangleCount > 0 ? getArea(right.minPos, right.maxPos) * (float)right.triangleCount : 0.f;
+                        }
+
+                        Bin left;
+                        for (uint32_t b = 1; b < kBinCount; b++)
+                        {
+                            left.minPos = glm::min(left.minPos, bins[b - 1].minPos);
+                            left.maxPos = glm::max(left.maxPos, bins[b - 1].maxPos);
+                            left.triangleCount += bins[b - 1].triangleCount;
+                            if (left.triangleCount == 0 || left.triangleCount == triangleCount) continue;
+
+                            float cost = getArea(left.minPos, left.maxPos) * (float)left.triangleCount + rightCost[b];
+                            if (cost < bestCost)
+                            {
+                                bestCost = cost;
+                                bestAxis = axis;
+                                bestBin = b;
+                            }
+                        }
+                    }
+
+                    uint32_t split = begin + (end - begin) / 2;
+                    if (bestCost < kMaxFloat)
+                    {
+                        float extent = centerMax[bestAxis] - centerMin[bestAxis];
+                        auto it = std::partition(items.begin() + begin, items.begin() + end, [&](const SplitItem& item)
+                        {
+                            return std::min((uint32_t)((item.center[bestAxis] - centerMin[bestAxis]) / extent * kBinCount), kBinCount - 1) < bestBin;
+                        });
+                        split = (uint32_t)(it - items.begin());
+                    }
+                    // Meshes with a zero-area or weightless split are divided by count instead
+                    if (split == begin || split == end) split = begin + (end - begin) / 2;
+
+                    // Left piece on top so pieces come out in order
+                    stack.push_back({ split, end });
+                    stack.push_back({ begin, split });
+                }
+                return pieces;
+            }
+
+            /** Split groups whose meshes have different instance masks. All meshes of a group share one TLAS instance and so one mask.
+                Meshes are stably sorted by mask within their group, so groups with a single mask are unchanged.
+            */
+            Result splitByMask(const Result& source, const std::vector<uint32_t>& meshMasks)
+            {
+                Result result;
+                result.groupMeshes = source.groupMeshes;
+                result.groupOffsets.reserve(source.groupOffsets.size());
+                bool split = false;
+                for (uint32_t g = 0; g < source.getGroupCount(); g++)
+                {
+                    auto first = result.groupMeshes.begin() + source.groupOffsets[g];
+                    auto last = result.groupMeshes.begin() + source.groupOffsets[g + 1];
+                    std::stable_sort(first, last, [&](uint32_t a, uint32_t b) { return meshMasks[a] < meshMasks[b]; });
+
+                    result.groupOffsets.push_back(source.groupOffsets[g]);
+                    for (auto it = first + 1; it < last; it++)
+                    {
+                        if (meshMasks[*it] == meshMasks[*(it - 1)]) continue;
+                        result.groupOffsets.push_back((uint32_t)(it - result.groupMeshes.begin()));
+                        split = true;
+                    }
+                }
+                result.groupOffsets.push_back((uint32_t)result.groupMeshes.size());
+
+                if (!split) return source;
+                reorderInstances(result, source);
+                return result;
+            }
+
+            uint32_t findRoot(std::vector<Piece>& pieces, uint32_t p)
+            {
+                while (pieces[p].mergedInto != p) p = pieces[p].mergedInto = pieces[pieces[p].mergedInto].mergedInto;
+                return p;
+            }
+
+            // Merges each piece below the minimum into the nearest piece that still has room for it
+            void mergePieces(std::vector<Piece>& pieces, const Options& options)
+            {
+                for (uint32_t p = 0; p < (uint32_t)pieces.size(); p++)
+                {
+                    if (pieces[p].mergedInto != p || pieces[p].triangleCount >= options.minTriangles) continue;
+
+                    uint32_t nearest = p;
+                    float nearestDist = std::numeric_limits<float>::max();
+                    for (uint32_t q = 0; q < (uint32_t)pieces.size(); q++)
+                    {
+                        if (q == p || pieces[q].mergedInto != q || pieces[q].triangleCount + pieces[p].triangleCount > options.maxTriangles) continue;
+                        float3 d = pieces[q].bounds.center - pieces[p].bounds.center;
+                        float dist = glm::dot(d, d);
+                        if (dist < nearestDist)
+                        {
+                            nearestDist = dist;
+                            nearest = q;
+                        }
+                    }
+                    if (nearest == p) continue;
+
+                    pieces[p].mergedInto = nearest;
+                    pieces[nearest].triangleCount += pieces[p].triangleCount;
+                    pieces[nearest].bounds = merge(pieces[nearest].bounds, pieces[p].bounds);
+                }
+            }
+        }
+
+        Result groupByTransform(uint32_t meshCount, const std::vector<MeshInstanceData>& instances)
+        {
+            assert(instances.size() <= UINT32_MAX);
+            const uint32_t instanceCount = (uint32_t)instances.size();
+            Result result;
+
+            // Counting sort of the instances by mesh. meshOffsets[m] is the first instance of mesh m in meshInstances, which keeps the original order per mesh.
+            std::vector<uint32_t> meshOffsets(meshCount + 1, 0);
+            uint32_t matrixCount = 0;
+            for (const auto& inst : instances)
+            {
+                assert(inst.meshID < meshCount);
+                meshOffsets[inst.meshID + 1]++;
+                matrixCount = std::max(matrixCount, inst.globalMatrixID + 1);
+            }
+            result.meshInstanceCount.assign(meshOffsets.begin() + 1, meshOffsets.end());
+            for (uint32_t m = 0; m < meshCount; m++) meshOffsets[m + 1] += meshOffsets[m];
+
+            std::vector<uint32_t> meshInstances(instanceCount);
+            {
+                std::vector<uint32_t> cursor(meshOffsets.begin(), meshOffsets.end() - 1);
+                for (uint32_t i = 0; i < instanceCount; i++) meshInstances[cursor[instances[i].meshID]++] = i;
+            }
+
+            // Counting sort of the non-instanced meshes by the global matrix of their instance
+            std::vector<uint32_t> matrixOffsets(matrixCount + 1, 0);
+            uint32_t nonInstancedCount = 0;
+            for (uint32_t m = 0; m < meshCount; m++)
+            {
+                if (result.meshInstanceCount[m] != 1) continue;
+                matrixOffsets[instances[meshInstances[meshOffsets[m]]].globalMatrixID + 1]++;
+                nonInstancedCount++;
+            }
+            for (uint32_t i = 0; i < matrixCount; i++) matrixOffsets[i + 1] += matrixOffsets[i];
+
+            uint32_t instancedCount = 0;
+            for (uint32_t m = 0; m < meshCount; m++) instancedCount += result.meshInstanceCount[m] > 1 ? 1 : 0;
+
+            result.groupMeshes.resize(nonInstancedCount + instancedCount);
+            {
+                std::vector<uint32_t> cursor(matrixOffsets.begin(), matrixOffsets.end() - 1);
+                for (uint32_t m = 0; m < meshCount; m++)
+                {
+                    if (result.meshInstanceCount[m] != 1) continue;
+                    result.groupMeshes[cursor[instances[meshInstances[meshOffsets[m]]].globalMatrixID]++] = m;
+                }
+            }
+
+            // Groups of non-instanced meshes, one per used matrix
+            result.groupOffsets.reserve(matrixCount + instancedCount + 1);
+            for (uint32_t i = 0; i < matrixCount; i++)
+            {
+                if (matrixOffsets[i + 1] > matrixOffsets[i]) result.groupOffsets.push_back(matrixOffsets[i]);
+            }
+
+            // Meshes with multiple instances go in their own groups
+            uint32_t offset = nonInstancedCount;
+            for (uint32_t m = 0; m < meshCount; m++)
+            {
+                if (result.meshInstanceCount[m] <= 1) continue;
+                result.groupOffsets.push_back(offset);
+                result.groupMeshes[offset++] = m;
+            }
+            result.groupOffsets.push_back(offset);
+
+            // New instance order: groups in order, meshes in group order, instances of a mesh in their original order
+            result.instanceOrder.resize(instanceCount);
+            result.meshFirstInstance.assign(meshCount, 0);
+            uint32_t next = 0;
+            for (uint32_t meshID : result.groupMeshes)
+            {
+                result.meshFirstInstance[meshID] = next;
+                for (uint32_t i = meshOffsets[meshID]; i < meshOffsets[meshID + 1]; i++) result.instanceOrder[next++] = meshInstances[i];
+            }
+            assert(next == instanceCount);
+
+            return result;
+        }
+
+        Result group(uint32_t meshCount, const std::vector<MeshInstanceData>& instances, const std::vector<BoundingBox>& meshBounds, const std::vector<uint32_t>& meshTriangleCounts, const std::vector<uint32_t>& meshMasks, const Options& options)
+        {
+            assert(meshBounds.size() == meshCount && meshTriangleCounts.size() == meshCount && meshMasks.size() == meshCount);
+            Result byTransform = splitByMask(groupByTransform(meshCount, instances), meshMasks);
+            if (options.policy == Policy::ByTransform) return byTransform;
+
+            Result result;
+            result.groupMeshes.reserve(byTransform.groupMeshes.size());
+            result.groupOffsets.reserve(byTransform.groupOffsets.size());
+
+            std::vector<SplitItem> items;
+            for (uint32_t g = 0; g < byTransform.getGroupCount(); g++)
+            {
+                auto first = byTransform.groupMeshes.begin() + byTransform.groupOffsets[g];
+                auto last = byTransform.groupMeshes.begin() + byTransform.groupOffsets[g + 1];
+
+                uint64_t triangleCount = 0;
+                for (auto it = first; it != last; it++) triangleCount += meshTriangleCounts[*it];
+
+                // Groups within the budget are kept as they are. This includes all meshes with multiple instances.
+                if (last - first == 1 || triangleCount <= options.maxTriangles)
+                {
+                    result.groupOffsets.push_back((uint32_t)result.groupMeshes.size());
+                    result.groupMeshes.insert(result.groupMeshes.end(), first, last);
+                    continue;
+                }
+
+                items.clear();
+                for (auto it = first; it != last; it++)
+                {
+                    const BoundingBox& bb = meshBounds[*it];
+                    items.push_back({ bb.getMinPos(), bb.getMaxPos(), bb.center, meshTriangleCounts[*it], *it });
+                }
+                std::vector<Piece> pieces = splitGroup(items, options.maxTriangles);
+                mergePieces(pieces, options);
+
+                // Emit one group per remaining piece, with the meshes of the pieces merged into it
+                std::vector<uint32_t> pieceOrder(pieces.size());
+                for (uint32_t p = 0; p < (uint32_t)pieces.size(); p++) pieceOrder[p] = p;
+                std::stable_sort(pieceOrder.begin(), pieceOrder.end(), [&](uint32_t a, uint32_t b) { return findRoot(pieces, a) < findRoot(pieces, b); });
+
+                uint32_t currentRoot = UINT32_MAX;
+                for (uint32_t p : pieceOrder)
+                {
+                    uint32_t root = findRoot(pieces, p);
+                    if (root != currentRoot) result.groupOffsets.push_back((uint32_t)result.groupMeshes.size());
+                    currentRoot = root;
+                    for (uint32_t i = pieces[p].begin; i < pieces[p].end; i++) result.groupMeshes.push_back(items[i].meshID);
+                }
+            }
+            result.groupOffsets.push_back((uint32_t)result.groupMeshes.size());
+
+            reorderInstances(result, byTransform);
+            return result;
+        }
+
+        float estimateTraceCost(const Result& grouping, const std::vector<uint32_t>& meshTriangleCounts, const std::vector<BoundingBox>& instanceBounds, const CostModel& model)
+        {
+            if (instanceBounds.empty()) return 0.f;
+
+            BoundingBox sceneBounds = instanceBounds[0];
+            for (const auto& bb : instanceBounds) sceneBounds = merge(sceneBounds, bb);
+            float sceneArea = getSurfaceArea(sceneBounds);
+            if (sceneArea <= 0.f) return 0.f;
+
+            // A group of several meshes is a single TLAS instance, a single mesh has one TLAS instance per mesh instance
+            float blasCost = 0.f;
+            uint32_t tlasInstanceCount = 0;
+            for (uint32_t g = 0; g < grouping.getGroupCount(); g++)
+            {
+                uint32_t firstMesh = grouping.groupMeshes[grouping.groupOffsets[g]];
+                if (grouping.groupOffsets[g + 1] - grouping.groupOffsets[g] > 1)
+                {
+                    uint64_t triangleCount = 0;
+                    BoundingBox bounds = instanceBounds[grouping.meshFirstInstance[firstMesh]];
+                    for (uint32_t i = grouping.groupOffsets[g]; i < grouping.groupOffsets[g + 1]; i++)
+                    {
+                        uint32_t meshID = grouping.groupMeshes[i];
+                        triangleCount += meshTriangleCounts[meshID];
+                        bounds = merge(bounds, instanceBounds[grouping.meshFirstInstance[meshID]]);
+                    }
+                    blasCost += getSurfaceArea(bounds) * getBlasCost(triangleCount, model);
+                    tlasInstanceCount++;
+                }
+                else
+                {
+                    float cost = getBlasCost(meshTriangleCounts[firstMesh], model);
+                    for (uint32_t i = 0; i < grouping.meshInstanceCount[firstMesh]; i++)
+                    {
+                        blasCost += getSurfaceArea(instanceBounds[grouping.meshFirstInstance[firstMesh] + i]) * cost;
+                    }
+                    tlasInstanceCount += grouping.meshInstanceCount[firstMesh];
+                }
+            }
+
+            return model.traversalCost * std::log2((float)std::max(tlasInstanceCount, 1u)) + blasCost / sceneArea;
+        }
+
+        Result groupByTransformReference(uint32_t meshCount, const std::vector<MeshInstanceData>& instances)
+        {
+            std::vector<std::vector<size_t>> instanceLists(meshCount);
+            for (size_t i = 0; i < instances.size(); i++) instanceLists[instances[i].meshID].push_back(i);
+
+            std::unordered_map<uint32_t, std::vector<uint32_t>> nodeToMeshList;
+            for (uint32_t meshId = 0; meshId < meshCount; meshId++)
+            {
+                if (instanceLists[meshId].size() != 1) continue;
+                nodeToMeshList[instances[instanceLists[meshId][0]].globalMatrixID].push_back(meshId);
+            }
+
+            std::vector<std::vector<uint32_t>> groups;
+            for (const auto& it : nodeToMeshList) groups.push_back(it.second);
+            for (uint32_t meshId = 0; meshId < meshCount; meshId++)
+            {
+                if (instanceLists[meshId].size() > 1) groups.push_back({ meshId });
+            }
+
+            Result result;
+            for (const auto& group : groups)
+            {
+                result.groupOffsets.push_back((uint32_t)result.groupMeshes.size());
+                for (uint32_t meshId : group)
+                {
+                    result.groupMeshes.push_back(meshId);
+                    for (size_t idx : instanceLists[meshId]) result.instanceOrder.push_back((uint32_t)idx);
+                }
+            }
+            result.groupOffsets.push_back((uint32_t)result.groupMeshes.size());
+            computeMeshRanges(result, meshCount, instances);
+            return result;
+        }
+
+        bool isEquivalent(const Result& a, const Result& b)
+        {
+            if (a.getGroupCount() != b.getGroupCount() || a.instanceOrder.size() != b.instanceOrder.size()) return false;
+
+            // Compare groups as sorted mesh lists, in a canonical order
+            auto canonicalGroups = [](const Result& r)
+            {
+                std::vector<std::vector<uint32_t>> groups(r.getGroupCount());
+                for (uint32_t g = 0; g < r.getGroupCount(); g++)
+                {
+                    groups[g].assign(r.groupMeshes.begin() + r.groupOffsets[g], r.groupMeshes.begin() + r.groupOffsets[g + 1]);
+                    std::sort(groups[g].begin(), groups[g].end());
+                }
+                std::sort(groups.begin(), groups.end());
+                return groups;
+            };
+            if (canonicalGroups(a) != canonicalGroups(b)) return false;
+
+            // Each mesh must list the same instances in the same order
+            if (a.meshInstanceCount != b.meshInstanceCount) return false;
+            for (size_t m = 0; m < a.meshInstanceCount.size(); m++)
+            {
+                for (uint32_t i = 0; i < a.meshInstanceCount[m]; i++)
+                {
+                    if (a.instanceOrder[a.meshFirstInstance[m] + i] != b.instanceOrder[b.meshFirstInstance[m] + i]) return false;
+                }
+            }
+            return true;
+        }
+
+        bool runBenchmark(uint32_t instanceCount)
+        {
+            const uint32_t kBenchmarkMaxTriangles = 1u << 22;
+
+            // Synthetic scene: most meshes have one instance and share a few thousand transforms, some meshes are instanced many times
+            std::mt19937 rng(1234);
+            uint32_t meshCount = std::max(instanceCount / 2, 1u);
+            uint32_t matrixCount = std::max(instanceCount / 256, 1u);
+            std::vector<MeshInstanceData> instances(instanceCount);
+            for (uint32_t i = 0; i < instanceCount; i++)
+            {
+                instances[i] = {};
+                instances[i].meshID = i < meshCount ? i : rng() % meshCount;
+                instances[i].globalMatrixID = rng() % matrixCount;
+            }
+
+            using Clock = std::chrono::high_resolution_clock;
+            auto ms = [](Clock::time_point t0) { return std::chrono::duration<double, std::milli>(Clock::now() - t0).count(); };
+
+            auto t0 = Clock::now();
+            Result reference = groupByTransformReference(meshCount, instances);
+            double referenceMs = ms(t0);
+
+            t0 = Clock::now();
+            Result result = groupByTransform(meshCount, instances);
+            double groupMs = ms(t0);
+
+            t0 = Clock::now();
+            applyPermutation(instances, result.instanceOrder);
+            double permuteMs = ms(t0);
+
+            bool equivalent = isEquivalent(result, reference);
+            logInfo("MeshGrouping benchmark, " + std::to_string(instanceCount) + " instances, " + std::to_string(result.getGroupCount()) + " groups: reference "
+                + std::to_string(referenceMs) + " ms, counting sort " + std::to_string(groupMs) + " ms + in-place permutation " + std::to_string(permuteMs) + " ms, "
+                + (equivalent ? "equivalent" : "NOT EQUIVALENT"));
+            if (!equivalent) logError("MeshGrouping: groupByTransform() doesn't match the reference grouping");
+
+            // Synthetic level: non-instanced meshes of various sizes scattered over a large area. Most share the level's transform,
+            // the others are props clustered around their own transform. Transforms are identities so local bounds are also world bounds.
+            std::uniform_real_distribution<float> position(0.f, 1000.f);
+            std::uniform_real_distribution<float> offset(-20.f, 20.f);
+            std::uniform_real_distribution<float> size(0.5f, 20.f);
+            const uint32_t kPropCount = 64;
+            std::vector<float3> propCenters(kPropCount);
+            for (auto& c : propCenters) c = float3(position(rng), 0.f, position(rng));
+
+            std::vector<MeshInstanceData> levelInstances(instanceCount);
+            std::vector<BoundingBox> meshBounds(instanceCount);
+            std::vector<uint32_t> meshTriangleCounts(instanceCount);
+            for (uint32_t i = 0; i < instanceCount; i++)
+            {
+                levelInstances[i] = {};
+                levelInstances[i].meshID = i;
+                levelInstances[i].globalMatrixID = rng() % 8 == 0 ? 1 + rng() % kPropCount : 0;
+
+                float3 center = levelInstances[i].globalMatrixID == 0
+                    ? float3(position(rng), position(rng) * 0.05f, position(rng))
+                    : propCenters[levelInstances[i].globalMatrixID - 1] + float3(offset(rng), offset(rng) * 0.25f, offset(rng));
+                meshBounds[i] = BoundingBox::fromMinMax(center - float3(size(rng)), center + float3(size(rng)));
+                meshTriangleCounts[i] = 10 + rng() % 4000;
+            }
+
+            for (Policy policy : { Policy::ByTransform, Policy::Spatial })
+            {
+                Options options;
+                options.policy = policy;
+                options.maxTriangles = kBenchmarkMaxTriangles;
+                t0 = Clock::now();
+                Result grouping = group(instanceCount, levelInstances, meshBounds, meshTriangleCounts, std::vector<uint32_t>(instanceCount, 0xff), options);
+                double policyMs = ms(t0);
+
+                std::vector<BoundingBox> instanceBounds(instanceCount);
+                for (uint32_t i = 0; i < instanceCount; i++) instanceBounds[i] = meshBounds[levelInstances[grouping.instanceOrder[i]].meshID];
+                float cost = estimateTraceCost(grouping, meshTriangleCounts, instanceBounds);
+                logInfo(std::string("MeshGrouping benchmark, ") + (policy == Policy::Spatial ? "spatial" : "by transform") + " policy: " + std::to_string(grouping.getGroupCount())
+                    + " groups in " + std::to_string(policyMs) + " ms, estimated trace cost " + std::to_string(cost));
+            }
+
+            return equivalent;
+        }
+    }
+}
@@ -0,0 +1,128 @@
+/***************************************************************************
+ # Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#pragma once
+#include <vector>
+
+namespace Falcor
+{
+    /** Grouping of meshes into BLASes, done by Scene::sortMeshes().
+        Non-instanced meshes that share a transform are grouped together, meshes with multiple instances get a group each.
+        All results are flat arrays so grouping a million instances takes a handful of allocations.
+        The spatial policy then splits groups over the triangle budget and merges the small pieces back with their neighbors.
+    */
+    namespace MeshGrouping
+    {
+        enum class Policy
+        {
+            ByTransform,    ///< One group per transform.
+            Spatial,        ///< Groups of a transform are split spatially to fit the triangle budget.
+        };
+
+        struct Options
+        {
+            Policy policy = Policy::ByTransform;
+            uint32_t maxTriangles = 1u << 20;   ///< Groups above this are split. Single meshes can still exceed it.
+            uint32_t minTriangles = 1u << 12;   ///< Pieces of a split group below this are merged with the nearest piece that has room.
+        };
+
+        /** Costs used by estimateTraceCost(), relative to each other.
+        */
+        struct CostModel
+        {
+            float traversalCost = 1.f;      ///< Cost of visiting a BVH node.
+            float intersectionCost = 1.f;   ///< Cost of a ray-triangle test.
+        };
+
+        struct Result
+        {
+            std::vector<uint32_t> groupOffsets;         ///< Group g holds groupMeshes[groupOffsets[g], groupOffsets[g + 1]).
+            std::vector<uint32_t> groupMeshes;
+            std::vector<uint32_t> instanceOrder;        ///< New instance i is old instance instanceOrder[i]. Instances are ordered by group, then mesh.
+            std::vector<uint32_t> meshFirstInstance;    ///< New ID of the first instance of each mesh. The instances of a mesh are contiguous.
+            std::vector<uint32_t> meshInstanceCount;
+
+            uint32_t getGroupCount() const { return (uint32_t)groupOffsets.size() - 1; }
+        };
+
+        /** Group meshes with counting sorts over mesh IDs and global matrix IDs. Groups of non-instanced meshes are ordered by matrix ID.
+        */
+        Result groupByTransform(uint32_t meshCount, const std::vector<MeshInstanceData>& instances);
+
+        /** Group meshes with the given policy.
+            \param[in] meshBounds Local-space bounds of each mesh. Only meshes that share a transform are compared, so they don't need to be transformed.
+            \param[in] meshTriangleCounts Triangle count of each mesh.
+            \param[in] meshMasks Instance mask of each mesh. Meshes with different masks are never grouped together.
+        */
+        Result group(uint32_t meshCount, const std::vector<MeshInstanceData>& instances, const std::vector<BoundingBox>& meshBounds, const std::vector<uint32_t>& meshTriangleCounts, const std::vector<uint32_t>& meshMasks, const Options& options);
+
+        /** Estimate the cost of tracing a ray through the TLAS and BLASes a grouping produces, with the surface area heuristic.
+            Each TLAS instance is hit with probability area / scene area and costs a BVH descent over its triangles.
+            The estimate doesn't need a GPU, so groupings can be compared offline.
+            \param[in] instanceBounds World-space bounds of each mesh instance, in the order of the grouping (after reordering).
+        */
+        float estimateTraceCost(const Result& grouping, const std::vector<uint32_t>& meshTriangleCounts, const std::vector<BoundingBox>& instanceBounds, const CostModel& model = {});
+
+        /** The hash-map based grouping Scene::sortMeshes() used before. Kept as the reference for groupByTransform().
+        */
+        Result groupByTransformReference(uint32_t meshCount, const std::vector<MeshInstanceData>& instances);
+
+        /** Check that two results have the same groups, ignoring group order, and the same instance order within each mesh.
+        */
+        bool isEquivalent(const Result& a, const Result& b);
+
+        /** Reorder data so that data[i] becomes the old data[order[i]], following the permutation's cycles instead of copying the array.
+        */
+        template<typename T>
+        void applyPermutation(std::vector<T>& data, const std::vector<uint32_t>& order)
+        {
+            assert(data.size() == order.size());
+            std::vector<bool> done(data.size(), false);
+            for (size_t start = 0; start < data.size(); start++)
+            {
+                if (done[start]) continue;
+
+                T tmp = std::move(data[start]);
+                size_t i = start;
+                while (order[i] != start)
+                {
+                    data[i] = std::move(data[order[i]]);
+                    done[i] = true;
+                    i = order[i];
+                }
+                data[i] = std::move(tmp);
+                done[i] = true;
+            }
+        }
+
+        /** Compare groupByTransform() against the reference on synthetic instance data and log both timings.
+            Also logs the estimated trace cost of both policies on a synthetic level where most meshes share one transform.
+            \return True if the results are equivalent.
+        */
+        bool runBenchmark(uint32_t instanceCount);
+    }
+}
@@ -28,8 +28,21 @@
 #include "stdafx.h"
 #include "Mogwai.h"
 #include "MogwaiSettings.h"
+#include "FramePacing.h"
+#include "MeshGrouping.h"
+#include "SceneCache.h"
+#include "InstanceBoundsCache.h"
+#include "AccelerationStructureArena.h"
+#include "DirtyRangeTracker.h"
+#include "BlasBuildPlanner.h"
+#include "FrustumCulling.h"
+#include "TransformKernels.h"
+#include "KeyframeFitting.h"
 #include <filesystem>
 #include <algorithm>
+#include <chrono>
+#include <limits>
+#include <psapi.h>
 
 namespace Mogwai
 {
@@ -43,8 +56,58 @@ namespace Mogwai
         const char* kScriptSwitch = "script";
         const char* kGraphFileSwitch = "graphFile";
         const char* kGraphNameSwitch = "graphName";
+        const char* kFramePacingSwitch = "framePacing";
+        const char* kFlushAfterUpdateSwitch = "flushAfterUpdate";
+        const char* kLightBenchmarkSwitch = "lightBenchmark";
+        const char* kMeshGroupingBenchmarkSwitch = "meshGroupingBenchmark";
+        const char* kBlasTriangleBudgetSwitch = "blasTriangleBudget";
+        const char* kTransformBenchmarkSwitch = "transformBenchmark";
+        const char* kBoundsBenchmarkSwitch = "boundsBenchmark";
+        const char* kArenaSelfCheckSwitch = "arenaSelfCheck";
+        const char* kDirtyRangeSelfCheckSwitch = "dirtyRangeSelfCheck";
+        const char* kBlasPlannerSelfCheckSwitch = "blasPlannerSelfCheck";
+        const char* kCullingSelfCheckSwitch = "cullingSelfCheck";
+        const char* kKeyframeBenchmarkSwitch = "keyframeBenchmark";
+        const char* kSceneCacheSwitch = "sceneCache";
+        const char* kSceneCacheBlasSwitch = "sceneCacheBlas";
+        const char* kFinalizeBenchmarkSwitch = "finalizeBenchmark";
+        const char* kSerialFinalizeSwitch = "serialFinalize";
+        const char* kLoadBenchmarkSwitch = "loadBenchmark";
 
         const std::string kAppDataPath = getAppDataDirectory() + "/NVIDIA/Falcor/Mogwai.json";
+        const std::string kSceneCacheDir = getAppDataDirectory() + "/NVIDIA/Falcor/SceneCache";
+
+        // Largest working set of the process so far
+        uint64_t getPeakResidentBytes()
+        {
+            PROCESS_MEMORY_COUNTERS counters = {};
+            if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+            return counters.PeakWorkingSetSize;
+        }
+
+        // Current working set of the process
+        uint64_t getResidentBytes()
+        {
+            PROCESS_MEMORY_COUNTERS counters = {};
+            if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+            return counters.WorkingSetSize;
+        }
+
+        // The cache file is named after the hash of the scene source, so editing the source starts a new cache
+        void setSceneCache(const std::string& sourceFile, bool cacheBlas)
+        {
+            uint64_t key = SceneCache::hashFile(sourceFile);
+            if (key == 0)
+            {
+                logWarning("Can't read '" + sourceFile + "', the scene cache is disabled");
+                return;
+            }
+
+            char name[32];
+            snprintf(name, sizeof(name), "%016llx.fcache", (unsigned long long)key);
+            std::filesystem::create_directories(kSceneCacheDir);
+            Scene::setSceneCache(kSceneCacheDir + "/" + name, key, cacheBlas);
+        }
     }
 
     size_t Renderer::DebugWindow::index = 0;
@@ -85,6 +148,70 @@ namespace Mogwai
 
         // If editor opened from running render graph, get the name of the file to read
         if (gpFramework->getArgList().argExists(kScriptSwitch)) loadScript(gpFramework->getArgList()[kScriptSwitch].asString());
+
+        // Periodically log how much CPU and GPU work overlap
+        if (gpFramework->getArgList().argExists(kFramePacingSwitch)) mFramePacing.setEnabled(true);
+
+        // e.g. "-framePacing -flushAfterUpdate", restores the submit Scene::update() used to do, as the baseline for the frame pacing numbers
+        Scene::setFlushAfterUpdate(gpFramework->getArgList().argExists(kFlushAfterUpdateSwitch));
+
+        // e.g. "-meshGroupingBenchmark 1000000", checks the mesh grouping against the reference implementation and logs both timings
+        if (gpFramework->getArgList().argExists(kMeshGroupingBenchmarkSwitch)) MeshGrouping::runBenchmark(gpFramework->getArgList()[kMeshGroupingBenchmarkSwitch].asUint());
+
+        // e.g. "-transformBenchmark 1000000", checks the SIMD flip test and bounds transform against the scalar code and logs both timings
+        if (gpFramework->getArgList().argExists(kTransformBenchmarkSwitch)) TransformKernels::runBenchmark(gpFramework->getArgList()[kTransformBenchmarkSwitch].asUint());
+
+        // e.g. "-boundsBenchmark 1000000", updates the cached instance bounds for a few fractions of moving transforms and logs the time against a full recompute
+        if (gpFramework->getArgList().argExists(kBoundsBenchmarkSwitch)) InstanceBoundsCache::runBenchmark(gpFramework->getArgList()[kBoundsBenchmarkSwitch].asUint());
+
+        // e.g. "-arenaSelfCheck", runs allocate/release sequences on the acceleration structure arena and logs any inconsistency
+        if (gpFramework->getArgList().argExists(kArenaSelfCheckSwitch)) AccelerationStructureArena::runSelfCheck();
+
+        // e.g. "-dirtyRangeSelfCheck", compares the merged dirty ranges of fixed and random mark sequences against a per-element reference
+        if (gpFramework->getArgList().argExists(kDirtyRangeSelfCheckSwitch)) DirtyRangeTracker::runSelfCheck();
+
+        // e.g. "-blasPlannerSelfCheck", plans fixed and random BLAS scratch sizes and checks the budget, the scratch ranges and that every build is planned once
+        if (gpFramework->getArgList().argExists(kBlasPlannerSelfCheckSwitch)) BlasBuildPlanner::runSelfCheck();
+
+        // e.g. "-cullingSelfCheck", tests fixed and random boxes against frustums and checks the culled draw lists against a test of every box corner
+        if (gpFramework->getArgList().argExists(kCullingSelfCheckSwitch)) FrustumCulling::runSelfCheck();
+
+        // e.g. "-keyframeBenchmark 10000", fits synthetic channels and logs the key reduction and the evaluation time before and after
+        if (gpFramework->getArgList().argExists(kKeyframeBenchmarkSwitch)) KeyframeFitting::runBenchmark(gpFramework->getArgList()[kKeyframeBenchmarkSwitch].asUint());
+
+        // e.g. "-loadBenchmark 5", loads the scene 5 times and logs the load time and memory of each load, then the fastest load and the peak
+        if (gpFramework->getArgList().argExists(kLoadBenchmarkSwitch))
+        {
+            uint32_t loadCount = std::max(gpFramework->getArgList()[kLoadBenchmarkSwitch].asUint(), 1u);
+            double minLoadTimeMs = std::numeric_limits<double>::max();
+            for (uint32_t i = 0; i < loadCount; i++)
+            {
+                // Release the previous scene first, so every load starts from the same working set
+                gpDevice->flushAndSync();
+                setScene(nullptr);
+                uint64_t residentBefore = getResidentBytes();
+
+                auto startTime = std::chrono::high_resolution_clock::now();
+                loadScene("");
+                gpDevice->flushAndSync();
+                double loadTimeMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+                minLoadTimeMs = std::min(minLoadTimeMs, loadTimeMs);
+
+                int64_t residentDelta = (int64_t)getResidentBytes() - (int64_t)residentBefore;
+                logInfo("Load " + std::to_string(i + 1) + "/" + std::to_string(loadCount) + ": " + std::to_string(loadTimeMs) + " ms, resident memory " + std::to_string(residentDelta / (1024 * 1024)) + " MB above the unloaded state");
+            }
+            logInfo("Load benchmark: fastest load " + std::to_string(minLoadTimeMs) + " ms, peak resident memory " + std::to_string(getPeakResidentBytes() / (1024 * 1024)) + " MB");
+        }
+
+        // e.g. "-blasTriangleBudget 1000000" splits the mesh groups of scenes loaded afterwards spatially to fit the budget
+        if (gpFramework->getArgList().argExists(kBlasTriangleBudgetSwitch))
+        {
+            MeshGrouping::Options options;
+            options.policy = MeshGrouping::Policy::Spatial;
+            options.maxTriangles = gpFramework->getArgList()[kBlasTriangleBudgetSwitch].asUint();
+            options.minTriangles = std::min(options.minTriangles, options.maxTriangles / 2);
+            Scene::setMeshGroupingOptions(options);
+        }
     }
 
     RenderGraph* Renderer::getActiveGraph() const
@@ -438,18 +565,108 @@ namespace Mogwai
         size_t animChannelId = animation->addChannel(matrixId);
         axis = axis / glm::length(axis);
 
+        std::vector<Animation::Keyframe> keyframes(animTime);
         for (uint i = 0; i < animTime; i++) {
-            Animation::Keyframe kf;
+            Animation::Keyframe& kf = keyframes[i];
             kf.time = float(i);
             kf.scaling = glm::vec3(scale);
             kf.rotation = glm::angleAxis(rotSpeed * i, axis);
             kf.translation = float3(sin(2 * std::_Pi * i / animTime), cos(2 * std::_Pi * i / animTime), cos(2 * std::_Pi * i / animTime)) * tranSpeed + transOffset;
-            animation->addKeyframe(animChannelId, kf);
+        }
+
+        // Only the keys needed to reproduce the motion within the fitting tolerance are added, which keeps the per-frame key search short
+        for (const auto& kf : KeyframeFitting::fit(keyframes)) animation->addKeyframe(animChannelId, kf);
+    }
+
+    // Adds animated point lights on a circle, every light moves every frame. Used to benchmark Scene::updateLights with large light counts.
+    static void addBenchmarkLights(SceneBuilder::SharedPtr& sceneBuilder, uint32_t lightCount)
+    {
+        uint32_t animTime = 16;
+        auto animation = Animation::create("LightBenchmark", animTime);
+
+        for (uint32_t i = 0; i < lightCount; i++)
+        {
+            auto pointLight = PointLight::create();
+            pointLight->setName("BenchmarkLight" + std::to_string(i));
+            pointLight->setIntensity(float3(1.0f / lightCount));
+
+            SceneBuilder::Node lightNode;
+            lightNode.name = pointLight->getName();
+            lightNode.transform = glm::identity<glm::mat4>();
+            uint32_t lightNodeId = sceneBuilder->addNode(lightNode);
+            sceneBuilder->addLight(pointLight, lightNodeId);
+
+            float angle = 2 * float(std::_Pi) * i / lightCount;
+            addKeyframes(animation, animTime, lightNodeId, 1.0f, 0.0f, float3(1, 0, 1), float3(cos(angle), 0.5f, sin(angle)) * 10.0f);
+        }
+
+        sceneBuilder->addAnimation(0, animation);
+    }
+
+    // Adds a grid of boxes to stress the CPU stages of Scene::finalize(). A few unique meshes are shared by many instances, which are spread over separate nodes.
+    static void addBenchmarkMeshes(SceneBuilder::SharedPtr& sceneBuilder, uint32_t instanceCount)
+    {
+        const uint32_t kMeshCount = 16;
+        const float3 kFaceNormals[6] = { float3(1, 0, 0), float3(-1, 0, 0), float3(0, 1, 0), float3(0, -1, 0), float3(0, 0, 1), float3(0, 0, -1) };
+
+        // Each face has its own 4 vertices so normals are flat
+        std::vector<float3> positions, normals, bitangents;
+        std::vector<float2> texCrds;
+        std::vector<uint32_t> indices;
+        for (const float3& n : kFaceNormals)
+        {
+            float3 t = std::abs(n.y) > 0.5f ? float3(1, 0, 0) : float3(0, 1, 0);
+            float3 b = glm::cross(n, t);
+            uint32_t base = (uint32_t)positions.size();
+            for (uint32_t v = 0; v < 4; v++)
+            {
+                float u = (v & 1) ? 1.f : -1.f;
+                float w = (v & 2) ? 1.f : -1.f;
+                positions.push_back(0.5f * (n + u * t + w * b));
+                normals.push_back(n);
+                bitangents.push_back(b);
+                texCrds.push_back(float2(u, w) * 0.5f + 0.5f);
+            }
+            for (uint32_t i : { 0u, 1u, 2u, 2u, 1u, 3u }) indices.push_back(base + i);
+        }
+
+        std::vector<uint32_t> meshIDs;
+        for (uint32_t m = 0; m < kMeshCount; m++)
+        {
+            auto pMaterial = Material::create("BenchmarkMaterial" + std::to_string(m));
+            pMaterial->setBaseColor(float4(float(m + 1) / kMeshCount, 0.5f, 0.5f, 1.f));
+
+            SceneBuilder::Mesh mesh;
+            mesh.name = "BenchmarkMesh" + std::to_string(m);
+            mesh.topology = Vao::Topology::TriangleList;
+            mesh.pMaterial = pMaterial;
+            mesh.vertexCount = (uint32_t)positions.size();
+            mesh.indexCount = (uint32_t)indices.size();
+            mesh.faceCount = mesh.indexCount / 3;
+            mesh.pIndices = indices.data();
+            mesh.pPositions = positions.data();
+            mesh.pNormals = normals.data();
+            mesh.pBitangents = bitangents.data();
+            mesh.pTexCrd = texCrds.data();
+            meshIDs.push_back(sceneBuilder->addMesh(mesh));
+        }
+
+        uint32_t gridSize = std::max(1u, (uint32_t)std::ceil(std::cbrt((float)instanceCount)));
+        for (uint32_t i = 0; i < instanceCount; i++)
+        {
+            float3 cell(float(i % gridSize), float((i / gridSize) % gridSize), float(i / (gridSize * gridSize)));
+
+            SceneBuilder::Node node;
+            node.name = "BenchmarkNode" + std::to_string(i);
+            node.transform = glm::translate(glm::identity<glm::mat4>(), 2.f * cell);
+            uint32_t nodeID = sceneBuilder->addNode(node);
+            sceneBuilder->addMeshInstance(nodeID, meshIDs[i % kMeshCount]);
         }
     }
 
     void Renderer::loadScene(std::string filename, SceneBuilder::Flags buildFlags)
     {
+        auto startTime = std::chrono::high_resolution_clock::now();
         auto sceneBuilder = SceneBuilder::create();
 
         // Sayantan, scene 1
@@ -496,8 +713,13 @@ namespace Mogwai
             //SceneBuilder::InstanceMatrices groundPlaneInstances = { glm::scale(glm::identity<glm::mat4>(), glm::vec3(20, 20, 20)) };
             //sceneBuilder->import("D:/projects/Rayster/models/modelLibrary/groundPlane.obj", groundPlaneInstances);
             SceneBuilder::InstanceMatrices objectInstance = { glm::translate(glm::identity<glm::mat4>(), glm::vec3(0,0,0)) };
-           
-            sceneBuilder->import("G:/chairTreeLightCameraKFValidation.dae", objectInstance);
+            const std::string sourceFile = "G:/chairTreeLightCameraKFValidation.dae";
+
+            // e.g. "-sceneCache" reuses the sorted scene data of the last load, "-sceneCacheBlas" also reuses the static BLASes
+            bool cacheBlas = gpFramework->getArgList().argExists(kSceneCacheBlasSwitch);
+            if (cacheBlas || gpFramework->getArgList().argExists(kSceneCacheSwitch)) setSceneCache(sourceFile, cacheBlas);
+
+            sceneBuilder->import(sourceFile, objectInstance);
             
             //sceneBuilder->import("D:/projects/Rayster/models/modelLibrary/basic-shapes/cube/cube.obj", objectInstance);
             //sceneBuilder->import("D:/projects/Rayster/models/modelLibrary/basic-shapes/torus/torus.obj", objectInstance);
@@ -542,6 +764,13 @@ namespace Mogwai
             //auto scene = sceneBuilder->getScene();
             //scene->toggleCameraAnimation()
 
+            // e.g. "-lightBenchmark 10000", the updateLights profiler event and the scene statistics show the upload cost
+            if (gpFramework->getArgList().argExists(kLightBenchmarkSwitch)) addBenchmarkLights(sceneBuilder, gpFramework->getArgList()[kLightBenchmarkSwitch].asUint());
+
+            // e.g. "-finalizeBenchmark 100000", Scene::finalize() logs its time. Add "-serialFinalize" to compare with the stages run in sequence.
+            if (gpFramework->getArgList().argExists(kFinalizeBenchmarkSwitch)) addBenchmarkMeshes(sceneBuilder, gpFramework->getArgList()[kFinalizeBenchmarkSwitch].asUint());
+            Scene::setParallelFinalize(!gpFramework->getArgList().argExists(kSerialFinalizeSwitch));
+
             auto scene = sceneBuilder->getScene();
             auto cam = scene->getCamera();
             cam->setFocalLength(65);
@@ -550,6 +779,10 @@ namespace Mogwai
             ((PointLight *)pointLight)->setOpeningAngle(float(std::_Pi) / 2.87f);
 
             setScene(sceneBuilder->getScene());
+
+            // Startup cost of the scene. The peak working set includes the importer's copy of the geometry and the staging memory of the uploads.
+            double loadTimeMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+            logInfo("Loaded '" + sourceFile + "' in " + std::to_string(loadTimeMs) + " ms, peak resident memory " + std::to_string(getPeakResidentBytes() / (1024 * 1024)) + " MB");
         }
     }
 
@@ -646,6 +879,7 @@ namespace Mogwai
             loadScript(s);
         }
 
+        mFramePacing.beginFrame();
         beginFrame(pRenderContext, pTargetFbo);
         applyEditorChanges();
 
@@ -690,6 +924,7 @@ namespace Mogwai
         }
 
         endFrame(pRenderContext, pTargetFbo);
+        mFramePacing.endFrame();
     }
 
     bool Renderer::onMouseEvent(const MouseEvent& mouseEvent)
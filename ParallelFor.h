@@ -0,0 +1,65 @@
+/***************************************************************************
+ # Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#pragma once
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+namespace Falcor
+{
+    /** Split [0, count) into contiguous ranges and run func(begin, end) on each, one range per thread.
+        Ranges are at least minBatchSize long, so small workloads run inline on the calling thread.
+        \return The number of ranges the work was split into.
+    */
+    template<typename Func>
+    size_t parallelFor(size_t count, size_t minBatchSize, Func&& func)
+    {
+        if (count == 0) return 0;
+
+        size_t threadCount = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+        size_t batchCount = std::min(threadCount, (count + minBatchSize - 1) / std::max<size_t>(minBatchSize, 1));
+        if (batchCount <= 1)
+        {
+            func(size_t(0), count);
+            return 1;
+        }
+
+        size_t batchSize = (count + batchCount - 1) / batchCount;
+        std::vector<std::thread> threads;
+        threads.reserve(batchCount - 1);
+        for (size_t b = 1; b < batchCount; b++)
+        {
+            size_t begin = b * batchSize;
+            size_t end = std::min(count, begin + batchSize);
+            if (begin < end) threads.emplace_back([&func, begin, end]() { func(begin, end); });
+        }
+        func(size_t(0), std::min(count, batchSize));
+        for (auto& t : threads) t.join();
+        return threads.size() + 1;
+    }
+}
@@ -27,6 +27,14 @@
  **************************************************************************/
 #include "PointShadowRT.h"
 #include <chrono>
+#include <filesystem>
+#include <sstream>
+
+namespace
+{
+    const char kOutputDir[] = "outputDir";
+    const char kSelfCheck[] = "selfCheck";
+}
 
 // Don't remove this. it's required for hot-reload to function properly
 extern "C" __declspec(dllexport) const char* getProjDir()
@@ -42,12 +50,21 @@ extern "C" __declspec(dllexport) void getPasses(Falcor::RenderPassLibrary& lib)
 PointShadowRT::SharedPtr PointShadowRT::create(RenderContext* pRenderContext, const Dictionary& dict)
 {
     SharedPtr pPass = SharedPtr(new PointShadowRT);
+
+    for (const auto& v : dict) {
+        if (v.key() == kOutputDir) pPass->mReference.outputDir = (std::string)v.val();
+        else if (v.key() == kSelfCheck) { if ((bool)v.val()) ShadowReference::runSelfCheck(); }
+        else logWarning("Unknown field '" + v.key() + "' in a PointShadowRT dictionary");
+    }
+
     return pPass;
 }
 
 Dictionary PointShadowRT::getScriptingDictionary()
 {
-    return Dictionary();
+    Dictionary dict;
+    dict[kOutputDir] = mReference.outputDir;
+    return dict;
 }
 
 RenderPassReflection PointShadowRT::reflect(const CompileData& compileData)
@@ -79,6 +96,9 @@ static float4 getLightData(const Light* pLight)
 }
 void PointShadowRT::execute(RenderContext* pRenderContext, const RenderData& renderData)
 {
+    // The scene's hit group stride grows when a program with more hit groups traces it. Matching it keeps this pass on the shared TLAS.
+    if (mpScene->getHitGroupStride() > mVisibilityPass.hitGroupCount) createProgram(mpScene->getHitGroupStride());
+
     mVisibilityPass.mpVars["worldPos"] = renderData["worldPos"]->asTexture();
     mVisibilityPass.mpVars["worldNorm"] = renderData["worldNorm"]->asTexture();
     mVisibilityPass.mpVars["outColor"] = renderData["output"]->asTexture();
@@ -97,15 +117,109 @@ void PointShadowRT::execute(RenderContext* pRenderContext, const RenderData& ren
 
     // calls ray-gen
     mpScene->raytrace(pRenderContext, mVisibilityPass.mpProgram.get(), mVisibilityPass.mpVars, uint3(targetDim, 1));
+
+    // The update flags only cover the current frame, so movement is tracked here rather than when the reference is requested.
+    if (is_set(mpScene->getUpdates(), Scene::UpdateFlags::MeshesMoved)) mReference.bvhValid = false;
+
+    if (mReference.requested)
+    {
+        mReference.requested = false;
+        computeReference(pRenderContext, renderData, seed);
+    }
+}
+
+void PointShadowRT::computeReference(RenderContext* pRenderContext, const RenderData& renderData, uint32_t seed)
+{
+    using namespace std::chrono;
+
+    // The BVH is kept until the scene changes or meshes move.
+    if (!mReference.bvhValid)
+    {
+        auto start = high_resolution_clock::now();
+        mReference.bvh.build(ShadowReference::gatherSceneTriangles(mpScene.get()));
+        mReference.buildTimeMs = duration<double, std::milli>(high_resolution_clock::now() - start).count();
+        mReference.bvhValid = true;
+    }
+
+    const auto& pWorldPos = renderData["worldPos"]->asTexture();
+    const auto& pWorldNorm = renderData["worldNorm"]->asTexture();
+    uint32_t width = pWorldPos->getWidth();
+    uint32_t height = pWorldPos->getHeight();
+
+    // Both inputs come from the G-buffer as RGBA32Float.
+    std::vector<uint8_t> worldPos = pRenderContext->readTextureSubresource(pWorldPos.get(), 0);
+    std::vector<uint8_t> worldNorm = pRenderContext->readTextureSubresource(pWorldNorm.get(), 0);
+    if (worldPos.size() != sizeof(float4) * width * height || worldNorm.size() != worldPos.size())
+    {
+        logWarning("PointShadowRT: CPU reference requires RGBA32Float worldPos/worldNorm inputs");
+        return;
+    }
+
+    ShadowReference::EmitterDesc emitter;
+    emitter.position = float3(getLightData(mpScene->getLight(0).get()));
+
+    auto start = high_resolution_clock::now();
+    std::vector<float4> image = ShadowReference::render(mReference.bvh, reinterpret_cast<const float4*>(worldPos.data()), reinterpret_cast<const float4*>(worldNorm.data()), width, height, emitter, seed);
+    mReference.renderTimeMs = duration<double, std::milli>(high_resolution_clock::now() - start).count();
+
+    uint64_t frameId = gpFramework->getGlobalClock().getFrame();
+    std::filesystem::path dir = mReference.outputDir.empty() ? std::filesystem::current_path() : std::filesystem::path(mReference.outputDir);
+    std::string filename = (dir / ("reference_" + std::to_string(frameId) + ".exr")).string();
+
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+    try
+    {
+        Bitmap::saveImage(filename, width, height, Bitmap::FileFormat::ExrFile, Bitmap::ExportFlags::ExportAlpha | Bitmap::ExportFlags::Uncompressed, ResourceFormat::RGBA32Float, true, image.data());
+    }
+    catch (const std::exception& e)
+    {
+        logWarning("PointShadowRT: failed to write CPU reference " + filename + ": " + e.what());
+        return;
+    }
+    if (!std::filesystem::exists(filename, ec))
+    {
+        logWarning("PointShadowRT: failed to write CPU reference " + filename);
+        return;
+    }
+
+    logInfo("PointShadowRT: CPU reference " + filename + ", " + std::to_string(mReference.bvh.getTriangleCount()) + " triangles, BVH build " + std::to_string(mReference.buildTimeMs) + " ms, render " + std::to_string(mReference.renderTimeMs) + " ms");
 }
 
 void PointShadowRT::renderUI(Gui::Widgets& widget)
 {
+    widget.textbox("Reference output dir", mReference.outputDir);
+    if (widget.button("Compute CPU reference")) mReference.requested = true;
+    if (widget.button("Run reference self-check", true)) ShadowReference::runSelfCheck();
+    if (mReference.bvhValid)
+    {
+        std::ostringstream oss;
+        oss << "Reference triangles: " << mReference.bvh.getTriangleCount() << std::endl
+            << "Reference BVH build: " << mReference.buildTimeMs << " ms" << std::endl
+            << "Reference render: " << mReference.renderTimeMs << " ms" << std::endl;
+        widget.text(oss.str());
+    }
 }
 
 void PointShadowRT::setScene(RenderContext* pRenderContext, const Scene::SharedPtr& pScene)
 {
     mpScene = pScene;
+    mReference.bvhValid = false;
+    createProgram(std::max(mpScene->getHitGroupStride(), 1u));
+}
+
+void PointShadowRT::createProgram(uint32_t hitGroupCount)
+{
+    RtProgram::Desc progDesc;
+    progDesc.addShaderLibrary("RenderPasses/PointShadowRT/shadow.rt.slang").setRayGen("rayGen");
+    progDesc.addMiss(0, "shadowMiss");
+    // Shadow rays skip the closest-hit shader, the any-hit shader alpha tests the geometry that isn't opaque.
+    // Shadow rays only use hit group 0. The unused ones pad the program to the scene's hit group stride, so the shader table has
+    // as many records per mesh as the shared TLAS expects and the scene doesn't build a TLAS for this pass alone.
+    for (uint32_t i = 0; i < hitGroupCount; i++) progDesc.addHitGroup(i, "shadowCHit", "shadowAnyHit");
+    progDesc.setMaxTraceRecursionDepth(1);
+    mVisibilityPass.mpProgram = RtProgram::create(progDesc, 4, 8); // 4 bytes - size of ray-payload, Default 8 bytes size of intersection/hit info (for builtin struct BuiltInTriangleIntersectionAttributes)
+    mVisibilityPass.hitGroupCount = hitGroupCount;
     mVisibilityPass.mpProgram->addDefines(mpScene->getSceneDefines());
 
     // Configure program.
@@ -126,12 +240,7 @@ void PointShadowRT::setScene(RenderContext* pRenderContext, const Scene::SharedP
 
 PointShadowRT::PointShadowRT()
 {
-    RtProgram::Desc progDesc;
-    progDesc.addShaderLibrary("RenderPasses/PointShadowRT/shadow.rt.slang").setRayGen("rayGen");
-    progDesc.addMiss(0, "shadowMiss");
-    progDesc.addHitGroup(0, "shadowCHit"); // A no-op hit-group must be provided, otherwise the program crashes.
-    progDesc.setMaxTraceRecursionDepth(1);
-    mVisibilityPass.mpProgram = RtProgram::create(progDesc, 4, 8); // 4 bytes - size of ray-payload, Default 8 bytes size of intersection/hit info (for builtin struct BuiltInTriangleIntersectionAttributes)
+    // The program is created by setScene(), its hit group count depends on the scene
 
     // Create a sample generator.
     mpSampleGenerator = SampleGenerator::create(SAMPLE_GENERATOR_UNIFORM);
@@ -29,6 +29,7 @@
 #include "Falcor.h"
 #include "FalcorExperimental.h"
 #include "Utils/Sampling/SampleGenerator.h"
+#include "ShadowReference.h"
 
 using namespace Falcor;
 
@@ -58,12 +59,29 @@ public:
 private:
     PointShadowRT();
 
+    void computeReference(RenderContext* pRenderContext, const RenderData& renderData, uint32_t seed);
+
+    /** Create the program and its vars for the current scene, padded to the given number of hit groups.
+    */
+    void createProgram(uint32_t hitGroupCount);
+
     struct
     {
         RtProgram::SharedPtr mpProgram;
         RtProgramVars::SharedPtr mpVars;
+        uint32_t hitGroupCount = 0;     ///< Hit groups in the program. Only the first one is used, the others pad it to the scene's hit group stride.
     } mVisibilityPass;
 
+    struct
+    {
+        bool requested = false;
+        ShadowReference::Bvh bvh;
+        bool bvhValid = false;          ///< Cleared whenever meshes move, so the next reference rebuilds the BVH.
+        std::string outputDir;          ///< Directory for the reference images. Empty writes to the working directory.
+        double buildTimeMs = 0;
+        double renderTimeMs = 0;
+    } mReference;
+
     Scene::SharedPtr mpScene;
     SampleGenerator::SharedPtr  mpSampleGenerator;
 };
@@ -0,0 +1,598 @@
+/***************************************************************************
+ # Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "ShadowReference.h"
+#include <atomic>
+#include <functional>
+#include <future>
+#include <random>
+#include <thread>
+#include <xmmintrin.h>
+
+namespace ShadowReference
+{
+    namespace
+    {
+        const uint32_t kBinCount = 16;
+        const uint32_t kMaxLeafSize = 4;
+        const uint32_t kParallelBuildThreshold = 4096;  // Subtrees smaller than this are built on the current thread.
+        const uint32_t kStackSize = 64;
+        const uint32_t kMaxDepth = kStackSize - 2;     // Traversal keeps at most one pending node per level, plus the two children of the current node.
+
+        struct Aabb
+        {
+            float3 minPoint = float3(FLT_MAX);
+            float3 maxPoint = float3(-FLT_MAX);
+
+            void include(const float3& p) { minPoint = glm::min(minPoint, p); maxPoint = glm::max(maxPoint, p); }
+            void include(const Aabb& b) { minPoint = glm::min(minPoint, b.minPoint); maxPoint = glm::max(maxPoint, b.maxPoint); }
+            float area() const
+            {
+                if (minPoint.x > maxPoint.x) return 0.f;
+                float3 e = maxPoint - minPoint;
+                return 2.f * (e.x * e.y + e.y * e.z + e.z * e.x);
+            }
+        };
+
+        struct BuildNode
+        {
+            Aabb bounds;
+            uint32_t begin = 0;
+            uint32_t end = 0;
+            std::unique_ptr<BuildNode> pChildren[2];
+        };
+
+        struct BuildContext
+        {
+            std::vector<Aabb> triBounds;
+            std::vector<float3> centroids;
+            std::vector<uint32_t> triIndices;
+            uint32_t parallelDepth = 0;
+        };
+
+        uint32_t resolveThreadCount(uint32_t threadCount)
+        {
+            if (threadCount == 0) threadCount = std::thread::hardware_concurrency();
+            return std::max(threadCount, 1u);
+        }
+
+        std::unique_ptr<BuildNode> buildRecursive(BuildContext& ctx, uint32_t begin, uint32_t end, uint32_t depth)
+        {
+            auto pNode = std::make_unique<BuildNode>();
+            pNode->begin = begin;
+            pNode->end = end;
+
+            Aabb centroidBounds;
+            for (uint32_t i = begin; i < end; i++)
+            {
+                pNode->bounds.include(ctx.triBounds[ctx.triIndices[i]]);
+                centroidBounds.include(ctx.centroids[ctx.triIndices[i]]);
+            }
+
+            // Degenerate splits can produce very deep trees. Nodes past the depth limit become leaves, so traversal never overflows its stack.
+            const uint32_t count = end - begin;
+            if (count <= kMaxLeafSize || depth >= kMaxDepth) return pNode;
+
+            // Binned SAH over all three axes.
+            float bestCost = FLT_MAX;
+            int bestAxis = -1;
+            uint32_t bestSplit = 0;
+            for (int axis = 0; axis < 3; axis++)
+            {
+                float extent = centroidBounds.maxPoint[axis] - centroidBounds.minPoint[axis];
+                if (extent <= 0.f) continue;
+
+                Aabb binBounds[kBinCount];
+                uint32_t binCounts[kBinCount] = {};
+                float scale = kBinCount / extent;
+                for (uint32_t i = begin; i < end; i++)
+                {
+                    uint32_t tri = ctx.triIndices[i];
+                    uint32_t bin = std::min(kBinCount - 1, (uint32_t)((ctx.centroids[tri][axis] - centroidBounds.minPoint[axis]) * scale));
+                    binBounds[bin].include(ctx.triBounds[tri]);
+                    binCounts[bin]++;
+                }
+
+                // Sweep from the right to get the suffix areas, then from the left to evaluate each split plane.
+                float rightArea[kBinCount];
+                uint32_t rightCount[kBinCount];
+                Aabb acc;
+                uint32_t n = 0;
+                for (uint32_t b = kBinCount - 1; b > 0; b--)
+                {
+                    acc.include(binBounds[b]);
+                    n += binCounts[b];
+                    rightArea[b] = acc.area();
+                    rightCount[b] = n;
+                }
+
+                acc = Aabb();
+                n = 0;
+                for (uint32_t b = 0; b < kBinCount - 1; b++)
+                {
+                    acc.include(binBounds[b]);
+                    n += binCounts[b];
+                    float cost = acc.area() * n + rightArea[b + 1] * rightCount[b + 1];
+                    if (n > 0 && rightCount[b + 1] > 0 && cost < bestCost)
+                    {
+                        bestCost = cost;
+                        bestAxis = axis;
+                        bestSplit = b + 1;
+                    }
+                }
+            }
+
+            uint32_t mid = begin;
+            if (bestAxis >= 0)
+            {
+                float leafCost = pNode->bounds.area() * count;
+                if (bestCost >= leafCost && count <= 4 * kMaxLeafSize) return pNode;
+
+                float extent = centroidBounds.maxPoint[bestAxis] - centroidBounds.minPoint[bestAxis];
+                float scale = kBinCount / extent;
+                auto it = std::partition(ctx.triIndices.begin() + begin, ctx.triIndices.begin() + end, [&](uint32_t tri)
+                {
+                    uint32_t bin = std::min(kBinCount - 1, (uint32_t)((ctx.centroids[tri][bestAxis] - centroidBounds.minPoint[bestAxis]) * scale));
+                    return bin < bestSplit;
+                });
+                mid = (uint32_t)(it - ctx.triIndices.begin());
+            }
+
+            // All centroids coincide, or the partition degenerated. Split in the middle.
+            if (mid == begin || mid == end) mid = begin + count / 2;
+
+            // Both halves touch disjoint ranges of triIndices, so the left subtree can be built concurrently.
+            if (depth < ctx.parallelDepth && count >= kParallelBuildThreshold)
+            {
+                auto left = std::async(std::launch::async, buildRecursive, std::ref(ctx), begin, mid, depth + 1);
+                pNode->pChildren[1] = buildRecursive(ctx, mid, end, depth + 1);
+                pNode->pChildren[0] = left.get();
+            }
+            else
+            {
+                pNode->pChildren[0] = buildRecursive(ctx, begin, mid, depth + 1);
+                pNode->pChildren[1] = buildRecursive(ctx, mid, end, depth + 1);
+            }
+            return pNode;
+        }
+
+        inline float3 safeDirection(float3 d)
+        {
+            // Avoid 0 * inf = NaN in the slab test.
+            for (int i = 0; i < 3; i++)
+            {
+                if (std::abs(d[i]) < 1e-20f) d[i] = std::copysign(1e-20f, d[i]);
+            }
+            return d;
+        }
+
+        /** Bilinear fetch with border addressing (zero outside), matching the sampler used by PointShadowRT.
+        */
+        float4 sampleBilinear(const float4* pData, uint32_t width, uint32_t height, float2 texC)
+        {
+            float x = texC.x * width - 0.5f;
+            float y = texC.y * height - 0.5f;
+            int x0 = (int)std::floor(x);
+            int y0 = (int)std::floor(y);
+            float fx = x - x0;
+            float fy = y - y0;
+
+            auto fetch = [&](int px, int py)
+            {
+                if (px < 0 || py < 0 || px >= (int)width || py >= (int)height) return float4(0);
+                return pData[(size_t)py * width + px];
+            };
+
+            float4 top = glm::mix(fetch(x0, y0), fetch(x0 + 1, y0), fx);
+            float4 bottom = glm::mix(fetch(x0, y0 + 1), fetch(x0 + 1, y0 + 1), fx);
+            return glm::mix(top, bottom, fy);
+        }
+
+        // Self-check scene: a ground plane at y = 0 seen straight from above, lit by an emitter above its center.
+        const uint32_t kCheckSize = 64;
+        const float kCheckGroundHalfSize = 5.f;
+        const float3 kCheckEmitterPosition = float3(0.f, 10.f, 0.f);
+        const float3 kCheckSphereCenter = float3(0.5f, 4.f, 0.3f);
+        const float kCheckSphereRadius = 1.5f;
+        const uint32_t kCheckSphereSegments = 64;
+
+        void addQuad(std::vector<float3>& positions, float y, float halfSize)
+        {
+            float3 v[4] = { float3(-halfSize, y, -halfSize), float3(halfSize, y, -halfSize), float3(halfSize, y, halfSize), float3(-halfSize, y, halfSize) };
+            for (uint32_t i : { 0, 1, 2, 0, 2, 3 }) positions.push_back(v[i]);
+        }
+
+        void addSphere(std::vector<float3>& positions, const float3& center, float radius, uint32_t segments)
+        {
+            const float kPi = 3.14159265f;
+            auto vertex = [&](uint32_t i, uint32_t j)
+            {
+                float theta = kPi * i / segments;
+                float phi = 2.f * kPi * j / segments;
+                return center + radius * float3(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+            };
+
+            for (uint32_t i = 0; i < segments; i++)
+            {
+                for (uint32_t j = 0; j < segments; j++)
+                {
+                    float3 v00 = vertex(i, j), v01 = vertex(i, j + 1), v10 = vertex(i + 1, j), v11 = vertex(i + 1, j + 1);
+                    for (const float3& p : { v00, v10, v11, v00, v11, v01 }) positions.push_back(p);
+                }
+            }
+        }
+
+        float3 checkGroundPosition(uint32_t x, uint32_t y)
+        {
+            float texel = 2.f * kCheckGroundHalfSize / kCheckSize;
+            return float3(-kCheckGroundHalfSize + (x + 0.5f) * texel, 0.f, -kCheckGroundHalfSize + (y + 0.5f) * texel);
+        }
+
+        float segmentDistance(const float3& p, const float3& a, const float3& b)
+        {
+            float3 ab = b - a;
+            float t = glm::clamp(glm::dot(p - a, ab) / glm::dot(ab, ab), 0.f, 1.f);
+            return glm::length(p - (a + t * ab));
+        }
+
+        /** Render the check scene with and without occluders and compare the visible fraction of each pixel to the closed-form value.
+            expected() returns the visibility of a pixel, or a negative value to skip it.
+        */
+        bool runCheckCase(const std::string& name, const std::vector<float3>& occluders, const EmitterDesc& emitter, const std::function<float(uint32_t, uint32_t)>& expected)
+        {
+            std::vector<float4> worldPos(kCheckSize * kCheckSize), worldNorm(kCheckSize * kCheckSize, float4(0, 1, 0, 0));
+            for (uint32_t y = 0; y < kCheckSize; y++)
+            {
+                for (uint32_t x = 0; x < kCheckSize; x++) worldPos[y * kCheckSize + x] = float4(checkGroundPosition(x, y), 1.f);
+            }
+
+            // The ground itself is part of the traced scene, so the lit case also catches self-intersection at tMin.
+            std::vector<float3> positions = occluders;
+            addQuad(positions, 0.f, kCheckGroundHalfSize);
+            Bvh emptyBvh, sceneBvh;
+            sceneBvh.build(positions);
+
+            const uint32_t seed = 1;
+            std::vector<float4> unoccluded = render(emptyBvh, worldPos.data(), worldNorm.data(), kCheckSize, kCheckSize, emitter, seed);
+            std::vector<float4> occluded = render(sceneBvh, worldPos.data(), worldNorm.data(), kCheckSize, kCheckSize, emitter, seed);
+
+            // The bilinear fetch fades to zero on the outermost texels, so only interior pixels are compared.
+            uint32_t checkedCount = 0, failedCount = 0;
+            for (uint32_t y = 1; y + 1 < kCheckSize; y++)
+            {
+                for (uint32_t x = 1; x + 1 < kCheckSize; x++)
+                {
+                    float reference = expected(x, y);
+                    float lit = unoccluded[y * kCheckSize + x].x;
+                    if (reference < 0.f || lit <= 0.f) continue;
+
+                    float visibility = occluded[y * kCheckSize + x].x / lit;
+                    checkedCount++;
+                    if (std::abs(visibility - reference) > 1e-3f) failedCount++;
+                }
+            }
+
+            bool success = checkedCount > 0 && failedCount == 0;
+            std::string msg = "ShadowReference self-check '" + name + "': " + std::to_string(failedCount) + " of " + std::to_string(checkedCount) + " pixels differ from the analytic visibility";
+            if (success) logInfo(msg);
+            else logError(msg);
+            return success;
+        }
+    }
+
+    void Bvh::build(std::vector<float3> positions, uint32_t threadCount)
+    {
+        assert(positions.size() % 3 == 0);
+        mNodes.clear();
+        mPositions.clear();
+
+        const uint32_t triCount = (uint32_t)positions.size() / 3;
+        if (triCount == 0) return;
+
+        BuildContext ctx;
+        ctx.triBounds.resize(triCount);
+        ctx.centroids.resize(triCount);
+        ctx.triIndices.resize(triCount);
+        for (uint32_t i = 0; i < triCount; i++)
+        {
+            Aabb& b = ctx.triBounds[i];
+            for (uint32_t k = 0; k < 3; k++) b.include(positions[3 * i + k]);
+            ctx.centroids[i] = (b.minPoint + b.maxPoint) * 0.5f;
+            ctx.triIndices[i] = i;
+        }
+
+        // Spawn tasks for the top levels only, enough to keep all threads busy.
+        uint32_t threads = resolveThreadCount(threadCount);
+        while ((1u << ctx.parallelDepth) < threads) ctx.parallelDepth++;
+
+        std::unique_ptr<BuildNode> pRoot = buildRecursive(ctx, 0, triCount, 0);
+
+        // Flatten depth-first so that the first child of an interior node is the next node.
+        mPositions.reserve(positions.size());
+        std::function<void(const BuildNode*)> flatten = [&](const BuildNode* pNode)
+        {
+            uint32_t index = (uint32_t)mNodes.size();
+            mNodes.push_back({});
+            mNodes[index].boundsMin = pNode->bounds.minPoint;
+            mNodes[index].boundsMax = pNode->bounds.maxPoint;
+
+            if (!pNode->pChildren[0])
+            {
+                mNodes[index].offset = (uint32_t)mPositions.size() / 3;
+                mNodes[index].count = pNode->end - pNode->begin;
+                for (uint32_t i = pNode->begin; i < pNode->end; i++)
+                {
+                    uint32_t tri = ctx.triIndices[i];
+                    for (uint32_t k = 0; k < 3; k++) mPositions.push_back(positions[3 * tri + k]);
+                }
+                return;
+            }
+
+            flatten(pNode->pChildren[0].get());
+            mNodes[index].offset = (uint32_t)mNodes.size();
+            mNodes[index].count = 0;
+            flatten(pNode->pChildren[1].get());
+        };
+        flatten(pRoot.get());
+    }
+
+    uint32_t Bvh::occluded4(const float3 origin[4], const float3 dir[4], uint32_t activeMask, float tMin, float tMax) const
+    {
+        if (mNodes.empty() || activeMask == 0) return 0;
+
+        // Transpose the packet to SoA.
+        alignas(16) float o[3][4], d[3][4], invD[3][4];
+        for (int lane = 0; lane < 4; lane++)
+        {
+            float3 sd = safeDirection(dir[lane]);
+            for (int c = 0; c < 3; c++)
+            {
+                o[c][lane] = origin[lane][c];
+                d[c][lane] = dir[lane][c];
+                invD[c][lane] = 1.f / sd[c];
+            }
+        }
+        const __m128 ox = _mm_load_ps(o[0]), oy = _mm_load_ps(o[1]), oz = _mm_load_ps(o[2]);
+        const __m128 dx = _mm_load_ps(d[0]), dy = _mm_load_ps(d[1]), dz = _mm_load_ps(d[2]);
+        const __m128 ix = _mm_load_ps(invD[0]), iy = _mm_load_ps(invD[1]), iz = _mm_load_ps(invD[2]);
+        const __m128 tMin4 = _mm_set1_ps(tMin), tMax4 = _mm_set1_ps(tMax);
+        const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.f), eps = _mm_set1_ps(1e-12f);
+
+        uint32_t active = activeMask & 0xf;
+        uint32_t occludedMask = 0;
+
+        uint32_t stack[kStackSize];
+        uint32_t stackSize = 0;
+        stack[stackSize++] = 0;
+
+        while (stackSize > 0)
+        {
+            const Node& node = mNodes[stack[--stackSize]];
+
+            // Slab test for all four rays.
+            __m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMin.x), ox), ix);
+            __m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMax.x), ox), ix);
+            __m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMin.y), oy), iy);
+            __m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMax.y), oy), iy);
+            __m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMin.z), oz), iz);
+            __m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMax.z), oz), iz);
+            __m128 tNear = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)), _mm_max_ps(_mm_min_ps(t0z, t1z), tMin4));
+            __m128 tFar = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)), _mm_min_ps(_mm_max_ps(t0z, t1z), tMax4));
+            uint32_t hitMask = (uint32_t)_mm_movemask_ps(_mm_cmple_ps(tNear, tFar)) & active;
+            if (hitMask == 0) continue;
+
+            if (node.count == 0)
+            {
+                assert(stackSize + 2 <= kStackSize);
+                stack[stackSize++] = node.offset;
+                stack[stackSize++] = (uint32_t)(&node - mNodes.data()) + 1;
+                continue;
+            }
+
+            // Moller-Trumbore, one triangle against the four rays.
+            for (uint32_t i = 0; i < node.count; i++)
+            {
+                const float3* v = &mPositions[3 * (node.offset + i)];
+                __m128 e1x = _mm_set1_ps(v[1].x - v[0].x), e1y = _mm_set1_ps(v[1].y - v[0].y), e1z = _mm_set1_ps(v[1].z - v[0].z);
+                __m128 e2x = _mm_set1_ps(v[2].x - v[0].x), e2y = _mm_set1_ps(v[2].y - v[0].y), e2z = _mm_set1_ps(v[2].z - v[0].z);
+
+                __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+                __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+                __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+                __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+                __m128 absDet = _mm_max_ps(det, _mm_sub_ps(zero, det));
+                __m128 invDet = _mm_div_ps(one, det);
+
+                __m128 sx = _mm_sub_ps(ox, _mm_set1_ps(v[0].x)), sy = _mm_sub_ps(oy, _mm_set1_ps(v[0].y)), sz = _mm_sub_ps(oz, _mm_set1_ps(v[0].z));
+                __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), invDet);
+
+                __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+                __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+                __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+                __m128 vv = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+                __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+
+                __m128 hit = _mm_cmpgt_ps(absDet, eps);
+                hit = _mm_and_ps(hit, _mm_cmpge_ps(u, zero));
+                hit = _mm_and_ps(hit, _mm_cmpge_ps(vv, zero));
+                hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(u, vv), one));
+                hit = _mm_and_ps(hit, _mm_cmpgt_ps(t, tMin4));
+                hit = _mm_and_ps(hit, _mm_cmplt_ps(t, tMax4));
+
+                uint32_t triHits = (uint32_t)_mm_movemask_ps(hit) & active;
+                occludedMask |= triHits;
+                active &= ~triHits;
+                if (active == 0) return occludedMask;
+            }
+        }
+
+        return occludedMask;
+    }
+
+    bool Bvh::occluded(const float3& origin, const float3& dir, float tMin, float tMax) const
+    {
+        float3 origins[4] = { origin, origin, origin, origin };
+        float3 dirs[4] = { dir, dir, dir, dir };
+        return occluded4(origins, dirs, 0x1, tMin, tMax) != 0;
+    }
+
+    std::vector<float4> render(const Bvh& bvh, const float4* worldPos, const float4* worldNorm, uint32_t width, uint32_t height, const EmitterDesc& emitter, uint32_t seed, uint32_t threadCount)
+    {
+        std::vector<float4> result((size_t)width * height, float4(0, 0, 0, 1));
+        if (width == 0 || height == 0 || emitter.sampleCount == 0) return result;
+
+        const float3 emitterNormal = glm::normalize(emitter.position);
+        const float3 emitterTangent = glm::normalize(glm::cross(emitterNormal, float3(1)));
+        const float3 emitterBiTangent = glm::cross(emitterNormal, emitterTangent);
+        const float invPi4 = 1.f / (4.f * 3.14159f);
+
+        std::atomic<uint32_t> nextRow = 0;
+        auto worker = [&]()
+        {
+            for (uint32_t y = nextRow++; y < height; y = nextRow++)
+            {
+                for (uint32_t x = 0; x < width; x++)
+                {
+                    std::mt19937 rng(seed ^ (y * width + x) * 0x9E3779B9u);
+                    std::uniform_real_distribution<float> dist(0.f, 1.f);
+
+                    float3 sum = float3(0);
+                    for (uint32_t first = 0; first < emitter.sampleCount; first += 4)
+                    {
+                        float3 origins[4], dirs[4];
+                        float weights[4] = {};
+                        uint32_t activeMask = 0;
+
+                        for (uint32_t lane = 0; lane < 4 && first + lane < emitter.sampleCount; lane++)
+                        {
+                            float2 uv = float2(dist(rng), dist(rng));
+                            float2 texC = (float2(x, y) + uv) / float2(width, height);
+                            float3 origin = float3(sampleBilinear(worldPos, width, height, texC));
+                            float3 normal = float3(sampleBilinear(worldNorm, width, height, texC));
+
+                            // Same jittered sample drives the emitter position, as in rayGen().
+                            float3 emitterPosition = emitter.position + emitter.size * (uv.x - 0.5f) * emitterTangent + emitter.size * (uv.y - 0.5f) * emitterBiTangent;
+                            float3 lightDir = emitterPosition - origin;
+                            float distance = glm::length(lightDir);
+                            lightDir /= distance;
+
+                            float cosSurface = std::max(glm::dot(lightDir, normal), 0.f);
+                            float cosEmitter = std::abs(glm::dot(lightDir, emitterNormal));
+
+                            origins[lane] = origin;
+                            dirs[lane] = lightDir;
+                            weights[lane] = cosSurface * cosEmitter * invPi4 / (distance * distance);
+                            if (weights[lane] > 0.f) activeMask |= 1u << lane;
+                        }
+
+                        uint32_t occludedMask = bvh.occluded4(origins, dirs, activeMask, emitter.tMin, emitter.tMax);
+                        for (uint32_t lane = 0; lane < 4; lane++)
+                        {
+                            if ((activeMask & ~occludedMask) & (1u << lane)) sum += float3(weights[lane]);
+                        }
+                    }
+
+                    result[(size_t)y * width + x] = float4(emitter.power * sum / float(emitter.sampleCount), 1.f);
+                }
+            }
+        };
+
+        std::vector<std::thread> threads(resolveThreadCount(threadCount) - 1);
+        for (auto& t : threads) t = std::thread(worker);
+        worker();
+        for (auto& t : threads) t.join();
+
+        return result;
+    }
+
+    bool runSelfCheck()
+    {
+        EmitterDesc emitter;
+        emitter.position = kCheckEmitterPosition;
+        emitter.sampleCount = 4;
+        bool success = true;
+
+        // Nothing between the ground and the emitter. Every sample is visible.
+        success &= runCheckCase("fully lit plane", {}, emitter, [](uint32_t, uint32_t) { return 1.f; });
+
+        // A plane halfway up that covers every path to the emitter.
+        std::vector<float3> blocker;
+        addQuad(blocker, 5.f, 4.f * kCheckGroundHalfSize);
+        success &= runCheckCase("fully occluded plane", blocker, emitter, [](uint32_t, uint32_t) { return 0.f; });
+
+        // A sphere under a near-point emitter casts a hard shadow. A pixel is in shadow iff the segment to the light passes through the sphere.
+        // Pixels whose segment grazes the silhouette are skipped: the samples are jittered within the pixel, and the tessellated sphere is slightly smaller than the true one.
+        std::vector<float3> sphere;
+        addSphere(sphere, kCheckSphereCenter, kCheckSphereRadius, kCheckSphereSegments);
+        emitter.size = 1e-4f;
+        const float texel = 2.f * kCheckGroundHalfSize / kCheckSize;
+        const float margin = kCheckSphereRadius * (1.f - std::cos(3.14159265f / kCheckSphereSegments)) + texel;
+        success &= runCheckCase("sphere over plane", sphere, emitter, [&](uint32_t x, uint32_t y)
+        {
+            float d = segmentDistance(kCheckSphereCenter, checkGroundPosition(x, y), kCheckEmitterPosition);
+            if (std::abs(d - kCheckSphereRadius) < margin) return -1.f;
+            return d < kCheckSphereRadius ? 0.f : 1.f;
+        });
+
+        return success;
+    }
+
+    std::vector<float3> gatherSceneTriangles(const Scene* pScene)
+    {
+        std::vector<float3> positions;
+
+        const auto& pBlock = pScene->getParameterBlock();
+        Buffer::SharedPtr pVertices = pBlock->getBuffer("vertices");
+        Buffer::SharedPtr pIndices = pBlock->getBuffer("indices");
+        if (!pVertices || !pIndices) return positions;
+
+        // Reading back GPU-only buffers flushes the pipeline. This is a debug path, so that's fine.
+        const PackedStaticVertexData* pVertexData = reinterpret_cast<const PackedStaticVertexData*>(pVertices->map(Buffer::MapType::Read));
+        const uint32_t* pIndexData = reinterpret_cast<const uint32_t*>(pIndices->map(Buffer::MapType::Read));
+        const auto& globalMatrices = pScene->getAnimationController()->getGlobalMatrices();
+
+        for (uint32_t instanceID = 0; instanceID < pScene->getMeshInstanceCount(); instanceID++)
+        {
+            const auto& instance = pScene->getMeshInstance(instanceID);
+            const auto& mesh = pScene->getMesh(instance.meshID);
+            const glm::mat4& transform = globalMatrices[instance.globalMatrixID];
+
+            // Same geometry as the GPU shadow rays see. Alpha-tested meshes are kept whole, the reference has no textures to test against.
+            if ((pScene->getMeshInstanceMask(instance.meshID) & kInstanceMaskCastsShadows) == 0) continue;
+
+            for (uint32_t i = 0; i < mesh.indexCount; i++)
+            {
+                uint32_t vertexID = mesh.vbOffset + pIndexData[mesh.ibOffset + i];
+                positions.push_back(float3(transform * float4(pVertexData[vertexID].position, 1.f)));
+            }
+        }
+
+        pVertices->unmap();
+        pIndices->unmap();
+        return positions;
+    }
+}
@@ -0,0 +1,112 @@
+/***************************************************************************
+ # Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#pragma once
+#include "Falcor.h"
+
+using namespace Falcor;
+
+/** CPU reference for the soft-shadow integral evaluated by shadow.rt.slang.
+    The tracer itself only depends on plain triangle data, so it can run on machines without a GPU.
+    gatherSceneTriangles() is the only part that needs a device, to read back the scene geometry.
+*/
+namespace ShadowReference
+{
+    /** Parameters of the square area emitter. Keep in sync with rayGen() in shadow.rt.slang.
+    */
+    struct EmitterDesc
+    {
+        float3 position = float3(0);    ///< Emitter center. Its normal is normalize(position), same as on the GPU.
+        float size = 0.5f;              ///< Side length of the emitter.
+        float power = 1200.f;           ///< Light power.
+        uint32_t sampleCount = 20;      ///< Samples per pixel.
+        float tMin = 0.01f;             ///< Shadow ray TMin.
+        float tMax = 1000.f;            ///< Shadow ray TMax.
+    };
+
+    /** Bounding volume hierarchy over world-space triangles, built with binned SAH.
+    */
+    class Bvh
+    {
+    public:
+        /** Build the BVH.
+            \param[in] positions World-space triangle vertices, three per triangle.
+            \param[in] threadCount Number of worker threads, 0 selects the hardware concurrency.
+        */
+        void build(std::vector<float3> positions, uint32_t threadCount = 0);
+
+        /** Test four rays for occlusion at once. Each lane is a separate ray.
+            \param[in] origin Ray origins.
+            \param[in] dir Ray directions (normalized).
+            \param[in] activeMask Bit i set if ray i should be traced.
+            \return Bit i set if ray i is occluded within [tMin, tMax].
+        */
+        uint32_t occluded4(const float3 origin[4], const float3 dir[4], uint32_t activeMask, float tMin, float tMax) const;
+
+        /** Test a single ray for occlusion.
+        */
+        bool occluded(const float3& origin, const float3& dir, float tMin, float tMax) const;
+
+        uint32_t getTriangleCount() const { return (uint32_t)mPositions.size() / 3; }
+        uint32_t getNodeCount() const { return (uint32_t)mNodes.size(); }
+
+    private:
+        struct Node
+        {
+            float3 boundsMin;
+            uint32_t offset;        ///< First triangle for leaves, second child for interior nodes (first child is the next node).
+            float3 boundsMax;
+            uint32_t count;         ///< Triangle count for leaves, 0 for interior nodes.
+        };
+
+        std::vector<Node> mNodes;
+        std::vector<float3> mPositions;  ///< Triangle vertices, reordered to match the leaves.
+    };
+
+    /** Evaluate the soft-shadow integral for a G-buffer.
+        \param[in] bvh Scene BVH.
+        \param[in] worldPos World position texture (RGBA32Float), width * height texels.
+        \param[in] worldNorm World normal texture (RGBA32Float), width * height texels.
+        \param[in] width Image width.
+        \param[in] height Image height.
+        \param[in] emitter Emitter description.
+        \param[in] seed Seed for the sample sequence.
+        \param[in] threadCount Number of worker threads, 0 selects the hardware concurrency.
+        \return The shaded image (RGBA32Float), same layout as the PointShadowRT output.
+    */
+    std::vector<float4> render(const Bvh& bvh, const float4* worldPos, const float4* worldNorm, uint32_t width, uint32_t height, const EmitterDesc& emitter, uint32_t seed, uint32_t threadCount = 0);
+
+    /** Compare the tracer against closed-form visibility on small analytic scenes (lit plane, fully occluded plane, sphere over a plane).
+        Results are logged per case.
+        \return True if all cases match.
+    */
+    bool runSelfCheck();
+
+    /** Read back the scene geometry and return world-space triangles for Bvh::build().
+    */
+    std::vector<float3> gatherSceneTriangles(const Scene* pScene);
+}
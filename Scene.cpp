@@ -30,6 +30,19 @@
 #include "HitInfo.h"
 #include "Raytracing/RtProgram/RtProgram.h"
 #include "Raytracing/RtProgramVars.h"
+#include "ParallelFor.h"
+#include "AccelerationStructureArena.h"
+#include "BlasBuildPlanner.h"
+#include "UploadRing.h"
+#include "DirtyRangeTracker.h"
+#include "FrustumCulling.h"
+#include "MeshGrouping.h"
+#include "SceneCache.h"
+#include "InstanceMask.slangh"
+#include "TransformKernels.h"
+#include <chrono>
+#include <future>
+#include <mutex>
 #include <sstream>
 
 namespace Falcor
@@ -39,12 +52,6 @@ namespace Falcor
 
     namespace
     {
-        // Checks if the transform flips the coordinate system handedness (its determinant is negative).
-        bool doesTransformFlip(const glm::mat4& m)
-        {
-            return glm::determinant((glm::mat3)m) < 0.f;
-        }
-
         const std::string kParameterBlockName = "gScene";
         const std::string kMeshBufferName = "meshes";
         const std::string kMeshInstanceBufferName = "meshInstances";
@@ -57,12 +64,55 @@ namespace Falcor
         const std::string kCamera = "camera";
         const std::string kGetLight = "getLight";
         const std::string kGetMaterial = "getMaterial";
+        const std::string kSetMeshInstanceMask = "setMeshInstanceMask";
         const std::string kSetEnvMap = "setEnvMap";
         const std::string kAddViewpoint = "addViewpoint";
         const std::string kRemoveViewpoint = "kRemoveViewpoint";
         const std::string kSelectViewpoint = "selectViewpoint";
+
+        const std::string kCullingShaderFile = "Scene/SceneCulling.cs.slang";
+
+        const size_t kBoundsBatchSize = 1 << 14;    // Instances per thread when transforming instance bounds.
+        const uint64_t kBlasScratchBudget = 64ull * 1024 * 1024;  // Scratch memory shared by a batch of BLAS builds.
+
+        // Refit BLASes are rebuilt once they pass this many refits. Only a few are rebuilt per frame, the rest keep refitting until their turn.
+        const uint32_t kBlasMaxRefits = 128;
+        const size_t kMaxBlasRebuildsPerFrame = 2;
+
+        const uint64_t kUploadRingSize = 4ull * 1024 * 1024;   // Initial size of the ring used for per-frame uploads.
+        const size_t kInstanceDescMergeGap = 8;     // Dirty instance desc runs closer than this are uploaded with one copy.
+        const uint32_t kLightMergeGap = 16;         // Changed lights closer than this are uploaded with one copy.
+        const uint32_t kMaterialMergeGap = 16;      // Changed materials closer than this are uploaded with one copy.
+        const uint32_t kBoundsMergeGap = 16;        // Moved instances closer than this upload their culling bounds with one copy.
+
+        std::vector<uint32_t> getTriangleCounts(const std::vector<MeshDesc>& meshes)
+        {
+            std::vector<uint32_t> triangleCounts(meshes.size());
+            for (size_t i = 0; i < meshes.size(); i++) triangleCounts[i] = meshes[i].indexCount / 3;
+            return triangleCounts;
+        }
+
+        // Copies a GPU buffer to the CPU. This waits for the GPU, so it is only used while loading.
+        template<typename T>
+        std::vector<T> readBuffer(RenderContext* pContext, const Buffer::SharedPtr& pBuffer)
+        {
+            Buffer::SharedPtr pReadback = Buffer::create(pBuffer->getSize(), Buffer::BindFlags::None, Buffer::CpuAccess::Read);
+            pContext->uavBarrier(pBuffer.get());
+            pContext->copyResource(pReadback.get(), pBuffer.get());
+            pContext->flush(true);
+
+            std::vector<T> data(pBuffer->getSize() / sizeof(T));
+            std::memcpy(data.data(), pReadback->map(Buffer::MapType::Read), data.size() * sizeof(T));
+            pReadback->unmap();
+            return data;
+        }
     }
 
+    MeshGrouping::Options Scene::sMeshGroupingOptions;
+    Scene::SceneCacheOptions Scene::sSceneCacheOptions;
+    bool Scene::sParallelFinalize = true;
+    bool Scene::sFlushAfterUpdate = false;
+
     const FileDialogFilterVec Scene::kFileExtensionFilters =
     {
         {"fscene"},
@@ -138,23 +188,135 @@ namespace Falcor
     void Scene::render(RenderContext* pContext, GraphicsState* pState, GraphicsVars* pVars, RenderFlags flags)
     {
         PROFILE("renderScene");
+        renderDrawLists(pContext, pState, pVars, flags, false, mpVao);
+    }
+
+    void Scene::render(RenderContext* pContext, GraphicsState* pState, GraphicsVars* pVars, const glm::mat4& cullViewProj, RenderFlags flags, uint32_t instanceMask)
+    {
+        PROFILE("renderSceneCulled");
+        cullDrawLists(pContext, { cullViewProj }, instanceMask);
+        renderDrawLists(pContext, pState, pVars, flags, true, mpVao);
+    }
+
+    void Scene::renderMultiView(RenderContext* pContext, GraphicsState* pState, GraphicsVars* pVars, const std::vector<glm::mat4>& viewProjs, RenderFlags flags, uint32_t instanceMask)
+    {
+        PROFILE("renderSceneMultiView");
+        assert(viewProjs.size() > 0 && viewProjs.size() <= FrustumCulling::kMaxViews);
+
+        // Every visible draw gets one instance per view. The program's vertex shader uses MultiView.slang to pick the view from SV_InstanceID.
+        cullDrawLists(pContext, viewProjs, instanceMask);
+        for (uint32_t i = 0; i < (uint32_t)viewProjs.size(); i++) pVars["MultiViewCB"]["gViewProj"][i] = viewProjs[i];
+        pVars["gViewMasks"] = mCulling.pViewMasks;
+        renderDrawLists(pContext, pState, pVars, flags, true, getMultiViewVao((uint32_t)viewProjs.size()));
+    }
+
+    const Vao::SharedPtr& Scene::getMultiViewVao(uint32_t viewCount)
+    {
+        auto& pVao = mMultiViewVaos[viewCount];
+        if (pVao) return pVao;
+
+        // Same buffers as the scene VAO, but the per-instance draw ID advances once every viewCount instances, so all views of a draw see the same mesh instance
+        const auto& pLayout = mpVao->getVertexLayout();
+        VertexLayout::SharedPtr pMultiViewLayout = VertexLayout::create();
+        Vao::BufferVec buffers;
+        for (uint32_t i = 0; i < (uint32_t)pLayout->getBufferCount(); i++)
+        {
+            VertexBufferLayout::SharedConstPtr pBufferLayout = pLayout->getBufferLayout(i);
+            buffers.push_back(mpVao->getVertexBuffer(i));
+            if (pBufferLayout && pBufferLayout->getInputClass() == VertexBufferLayout::InputClass::PerInstanceData)
+            {
+                VertexBufferLayout::SharedPtr pStepped = VertexBufferLayout::create();
+                for (uint32_t e = 0; e < pBufferLayout->getElementCount(); e++)
+                {
+                    pStepped->addElement(pBufferLayout->getElementName(e), pBufferLayout->getElementOffset(e), pBufferLayout->getElementFormat(e), pBufferLayout->getElementArraySize(e), pBufferLayout->getElementShaderLocation(e));
+                }
+                pStepped->setInputClass(VertexBufferLayout::InputClass::PerInstanceData, viewCount);
+                pBufferLayout = pStepped;
+            }
+            pMultiViewLayout->addBufferLayout(i, pBufferLayout);
+        }
+
+        pVao = Vao::create(mpVao->getPrimitiveTopology(), pMultiViewLayout, buffers, mpVao->getIndexBuffer(), mpVao->getIndexBufferFormat());
+        return pVao;
+    }
+
+    void Scene::cullDrawLists(RenderContext* pContext, const std::vector<glm::mat4>& viewProjs, uint32_t instanceMask)
+    {
+        PROFILE("cullDrawLists");
+
+        if (mCulling.pPass == nullptr) mCulling.pPass = ComputePass::create(kCullingShaderFile);
+
+        // Bounds are only uploaded when culling is used, and only for the instances that moved since the last upload
+        if (!mCulling.dirtyBounds.empty())
+        {
+            const uint64_t kInstanceSize = 2 * sizeof(float4);
+            auto alloc = mpUploadRing->allocate(mCulling.dirtyBounds.getElementCount() * kInstanceSize);
+            uint64_t offset = 0;
+            for (const auto& range : mCulling.dirtyBounds.getRanges())
+            {
+                uint64_t size = (range.end - range.begin) * kInstanceSize;
+                mInstanceBounds.pack((float4*)(alloc.pData + offset), range.begin, range.end);
+                pContext->copyBufferRegion(mCulling.pInstanceBounds.get(), range.begin * kInstanceSize, alloc.pBuffer, alloc.offset + offset, size);
+                offset += size;
+            }
+            mCulling.dirtyBounds.clear();
+        }
+
+        if (mCulling.masksDirty)
+        {
+            std::vector<uint32_t> masks(mMeshInstanceData.size());
+            for (size_t i = 0; i < masks.size(); i++) masks[i] = mMeshMasks[mMeshInstanceData[i].meshID];
+            mpUploadRing->upload(pContext, mCulling.pInstanceMasks.get(), 0, masks.data(), masks.size() * sizeof(uint32_t));
+            mCulling.masksDirty = false;
+        }
+
+        auto& pass = *mCulling.pPass;
+        for (uint32_t view = 0; view < (uint32_t)viewProjs.size(); view++)
+        {
+            FrustumCulling::Frustum frustum = FrustumCulling::extractFrustum(viewProjs[view]);
+            for (uint32_t i = 0; i < 6; i++) pass["CullCB"]["gPlanes"][view * 6 + i] = frustum.planes[i];
+        }
+        pass["CullCB"]["gDrawCount"] = uint2(mDrawCounterClockwiseMeshes.count, mDrawClockwiseMeshes.count);
+        pass["CullCB"]["gViewCount"] = (uint32_t)viewProjs.size();
+        pass["CullCB"]["gInstanceMask"] = instanceMask;
+        pass["gDrawArgs0"] = mDrawCounterClockwiseMeshes.pBuffer;
+        pass["gDrawArgs1"] = mDrawClockwiseMeshes.pBuffer;
+        pass["gCulledDrawArgs0"] = mDrawCounterClockwiseMeshes.pCulledBuffer;
+        pass["gCulledDrawArgs1"] = mDrawClockwiseMeshes.pCulledBuffer;
+        pass["gInstanceBounds"] = mCulling.pInstanceBounds;
+        pass["gInstanceMasks"] = mCulling.pInstanceMasks;
+        pass["gVisibleCount"] = mCulling.pVisibleCount;
+        pass["gViewMasks"] = mCulling.pViewMasks;
+
+        pContext->clearUAV(mCulling.pVisibleCount->getUAV().get(), uint4(0));
+        pass.execute(pContext, mDrawCounterClockwiseMeshes.count + mDrawClockwiseMeshes.count);
+    }
 
-        pState->setVao(mpVao);
+    void Scene::renderDrawLists(RenderContext* pContext, GraphicsState* pState, GraphicsVars* pVars, RenderFlags flags, bool culled, const Vao::SharedPtr& pVao)
+    {
+        pState->setVao(pVao);
         pVars->setParameterBlock("gScene", mpSceneBlock);
 
         bool overrideRS = !is_set(flags, RenderFlags::UserRasterizerState);
         auto pCurrentRS = pState->getRasterizerState();
 
+        // Culled lists take their draw count from the count buffer, the list size is the upper bound
+        auto drawList = [&](const auto& list, uint32_t listIndex)
+        {
+            if (culled) pContext->drawIndexedIndirect(pState, pVars, list.count, list.pCulledBuffer.get(), 0, mCulling.pVisibleCount.get(), listIndex * sizeof(uint32_t));
+            else pContext->drawIndexedIndirect(pState, pVars, list.count, list.pBuffer.get(), 0, nullptr, 0);
+        };
+
         if (mDrawCounterClockwiseMeshes.count)
         {
             if (overrideRS) pState->setRasterizerState(nullptr);
-            pContext->drawIndexedIndirect(pState, pVars, mDrawCounterClockwiseMeshes.count, mDrawCounterClockwiseMeshes.pBuffer.get(), 0, nullptr, 0);
+            drawList(mDrawCounterClockwiseMeshes, 0);
         }
 
         if (mDrawClockwiseMeshes.count)
         {
             if (overrideRS) pState->setRasterizerState(mpFrontClockwiseRS);
-            pContext->drawIndexedIndirect(pState, pVars, mDrawClockwiseMeshes.count, mDrawClockwiseMeshes.pBuffer.get(), 0, nullptr, 0);
+            drawList(mDrawClockwiseMeshes, 1);
         }
 
         if (overrideRS) pState->setRasterizerState(pCurrentRS);
@@ -197,6 +359,13 @@ namespace Falcor
         {
             mpLightsBuffer = Buffer::createStructured(mpSceneBlock[kLightsBufferName], (uint32_t)mLights.size(), Resource::BindFlags::ShaderResource, Buffer::CpuAccess::None, nullptr, false);
         }
+        mMaterialData.resize(mMaterials.size());
+        mDirtyMaterials.setMaxGap(kMaterialMergeGap);
+        mLightData.resize(mLights.size());
+        mDirtyLights.setMaxGap(kLightMergeGap);
+        mCulling.dirtyBounds.setMaxGap(kBoundsMergeGap);
+
+        mpUploadRing = UploadRing::create(kUploadRingSize);
     }
 
     void Scene::uploadResources()
@@ -219,17 +388,35 @@ namespace Falcor
         }
     }
 
-    // TODO: On initial upload of materials, we could improve this by not having separate calls to setElement()
-    // but instead prepare a buffer containing all data.
     void Scene::uploadMaterial(uint32_t materialID)
     {
         assert(materialID < mMaterials.size());
 
-        const auto &material = mMaterials[materialID];
+        mMaterialData[materialID] = mMaterials[materialID]->getData();
+        mDirtyMaterials.mark(materialID);
+        bindMaterialResources(materialID);
+        uploadMaterials();
+    }
+
+    void Scene::uploadMaterials()
+    {
+        if (mDirtyMaterials.empty()) return;
 
-        mpMaterialsBuffer->setElement(materialID, material->getData());
+        // Uploading all materials only happens at load time. It uses a single setBlob rather than growing the ring for a one-off upload.
+        if (mDirtyMaterials.getElementCount() == mMaterialData.size())
+        {
+            mpMaterialsBuffer->setBlob(mMaterialData.data(), 0, sizeof(MaterialData) * mMaterialData.size());
+            mDirtyMaterials.clear();
+        }
+        else
+        {
+            mpUploadRing->uploadRanges(gpDevice->getRenderContext(), mpMaterialsBuffer.get(), mMaterialData.data(), sizeof(MaterialData), mDirtyMaterials);
+        }
+    }
 
-        const auto& resources = material->getResources();
+    void Scene::bindMaterialResources(uint32_t materialID)
+    {
+        const auto& resources = mMaterials[materialID]->getResources();
 
         auto var = mpSceneBlock["materialResources"][materialID];
 
@@ -246,43 +433,103 @@ namespace Falcor
 
     void Scene::updateBounds()
     {
+        // Runs on a worker during finalize(). It must not touch the device, the profiler or state the main thread writes meanwhile,
+        // so profiling is left to the callers. The culling bounds tracker is only written here until finalize() is done.
         const auto& globalMatrices = mpAnimationController->getGlobalMatrices();
-        std::vector<BoundingBox> instanceBBs;
-        instanceBBs.reserve(mMeshInstanceData.size());
 
-        for (const auto& inst : mMeshInstanceData)
+        // The first call transforms every instance. After that, only instances whose matrix changed are updated.
+        // The matrix and mesh of each instance are kept in their own arrays, so the scan for changed instances doesn't walk the instance data.
+        bool updateAll = mInstanceBounds.size() != mMeshInstanceData.size();
+        if (updateAll)
         {
-            const BoundingBox& meshBB = mMeshBBs[inst.meshID];
-            const glm::mat4& transform = globalMatrices[inst.globalMatrixID];
-            instanceBBs.push_back(meshBB.transform(transform));
+            mInstanceBounds.resize(mMeshInstanceData.size());
+            mInstanceMatrixIDs.resize(mMeshInstanceData.size());
+            mInstanceMeshIDs.resize(mMeshInstanceData.size());
+            for (size_t i = 0; i < mMeshInstanceData.size(); i++)
+            {
+                mInstanceMatrixIDs[i] = mMeshInstanceData[i].globalMatrixID;
+                mInstanceMeshIDs[i] = mMeshInstanceData[i].meshID;
+            }
         }
 
-        mSceneBB = instanceBBs.front();
-        for (const BoundingBox& bb : instanceBBs)
+        std::mutex dirtyBoundsMutex;
+        parallelFor(mMeshInstanceData.size(), kBoundsBatchSize, [&](size_t begin, size_t end)
         {
-            mSceneBB = BoundingBox::fromUnion(mSceneBB, bb);
-        }
+            // Changed instances are collected and transformed four at a time
+            std::vector<uint32_t> indices;
+            indices.reserve(end - begin);
+            for (size_t i = begin; i < end; i++)
+            {
+                if (updateAll || mpAnimationController->didMatrixChanged(mInstanceMatrixIDs[i])) indices.push_back((uint32_t)i);
+            }
+            mInstanceBounds.setTransformed(globalMatrices.data(), mMeshBBs.data(), mInstanceMatrixIDs.data(), mInstanceMeshIDs.data(), indices.data(), indices.size());
+
+            // The batch's indices are merged locally, so the shared tracker is only locked once per batch
+            DirtyRangeTracker changed(kBoundsMergeGap);
+            for (uint32_t i : indices) changed.mark(i);
+            std::lock_guard<std::mutex> lock(dirtyBoundsMutex);
+            for (const auto& range : changed.getRanges()) mCulling.dirtyBounds.markRange(range.begin, range.end);
+        });
+
+        // Batches finish in any order. Merging now keeps the ranges from piling up over frames that don't cull.
+        mCulling.dirtyBounds.getRanges();
+        mSceneBB = mInstanceBounds.reduce();
     }
 
-    void Scene::updateMeshInstanceFlags()
+    bool Scene::updateMeshInstanceFlags()
     {
-        for (auto& inst : mMeshInstanceData)
+        // The flip test runs once per matrix rather than once per instance
+        const auto& globalMatrices = mpAnimationController->getGlobalMatrices();
+        mMatrixFlips.resize(globalMatrices.size());
+        parallelFor(globalMatrices.size(), kBoundsBatchSize, [&](size_t begin, size_t end)
+        {
+            TransformKernels::computeFlips(globalMatrices.data(), begin, end, mMatrixFlips.data());
+        });
+
+        bool changed = false;
+        for (uint32_t instanceID = 0; instanceID < (uint32_t)mMeshInstanceData.size(); instanceID++)
         {
-            inst.flags = MeshInstanceFlags::None;
+            auto& inst = mMeshInstanceData[instanceID];
+            MeshInstanceFlags flags = MeshInstanceFlags::None;
+            if (mMatrixFlips[inst.globalMatrixID]) flags |= MeshInstanceFlags::Flipped;
+            if (inst.flags == flags) continue;
 
-            const glm::mat4& transform = mpAnimationController->getGlobalMatrices()[inst.globalMatrixID];
-            if (doesTransformFlip(transform)) inst.flags |= MeshInstanceFlags::Flipped;
+            // Once the draw lists exist, instances that change winding move to the other list
+            bool flipped = is_set(flags, MeshInstanceFlags::Flipped);
+            if (!mDrawListSlots.empty() && flipped != is_set(inst.flags, MeshInstanceFlags::Flipped)) moveDraw(instanceID, flipped);
+
+            inst.flags = flags;
+            changed = true;
         }
+        return changed;
     }
 
     void Scene::finalize()
     {
+        auto startTime = std::chrono::high_resolution_clock::now();
+
+        // CPU stages run as tasks while this thread does the work that needs the device. Each task writes its own data and
+        // only the main thread uses the device, the profiler and the logger. Deferred tasks run when they are waited on, which gives the serial order for comparison.
+        std::launch policy = sParallelFinalize ? std::launch::async : std::launch::deferred;
+
+        // A scene cache hit replaces the instance array, so sorting must finish before the resources are sized from it
         sortMeshes();
         initResources();
         mpAnimationController->animate(gpDevice->getRenderContext(), 0); // Requires Scene block to exist
-        updateMeshInstanceFlags();
-        updateBounds();
+
+        // These stages only read the animated matrices. Flags and bounds write different members of the instances.
+        auto flagsTask = std::async(policy, [this]() { updateMeshInstanceFlags(); });
+        auto boundsTask = std::async(policy, [this]() { updateBounds(); estimateMeshGroupingCost(); });
+        auto statsTask = std::async(policy, [this]() { updateGeometryStats(); });
+        auto materialsTask = std::async(policy, [this]()
+        {
+            for (size_t i = 0; i < mMaterials.size(); i++) mMaterialData[i] = mMaterials[i]->getData();
+        });
+
+        flagsTask.get();
         createDrawList();
+        boundsTask.get(); // The camera is placed from the scene bounds
+        logInfo("Estimated trace cost of the BLAS grouping: " + std::to_string(mBlasStats.groupingCost));
         if (mCamera.pObject == nullptr)
         {
             mCamera.pObject = Camera::create();
@@ -291,10 +538,17 @@ namespace Falcor
         setCameraController(mCamCtrlType);
         updateCamera(true);
         addViewpoint();
+        materialsTask.get();
+        statsTask.get();
+
+        // All uploads are recorded together once the CPU data is complete
         updateLights(true);
-        updateMaterials(true);
-        uploadResources(); // Upload data after initialization is complete
-        updateGeometryStats();
+        initMaterials();
+        uploadResources();
+        writeSceneCache();
+
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+        logInfo("Finalized the scene " + std::string(sParallelFinalize ? "in parallel" : "serially") + " in " + std::to_string(ms) + " ms");
 
         if (mpAnimationController->getMeshAnimationCount(0)) mpAnimationController->setActiveAnimation(0, 0);
     }
@@ -385,9 +639,11 @@ namespace Falcor
 
     Scene::UpdateFlags Scene::updateLights(bool forceUpdate)
     {
+        PROFILE("updateLights");
+
         UpdateFlags flags = UpdateFlags::None;
 
-        for (size_t i = 0; i < mLights.size(); i++)
+        for (uint32_t i = 0; i < (uint32_t)mLights.size(); i++)
         {
             auto& light = mLights[i];
             light.update(mpAnimationController.get(), forceUpdate);
@@ -395,8 +651,9 @@ namespace Falcor
 
             if (lightChanges != Light::Changes::None)
             {
-                // TODO: This is slow since the buffer is not CPU writable. Copy into CPU buffer and upload once instead.
-                mpLightsBuffer->setBlob(&light.pObject->getData(), sizeof(LightData) * i, sizeof(LightData));
+                // Update the CPU copy, the changed lights are uploaded together below
+                mLightData[i] = light.pObject->getData();
+                mDirtyLights.mark(i);
                 if (is_set(lightChanges, Light::Changes::Intensity)) flags |= UpdateFlags::LightIntensityChanged;
                 if (is_set(lightChanges, Light::Changes::Position)) flags |= UpdateFlags::LightsMoved;
                 if (is_set(lightChanges, Light::Changes::Direction)) flags |= UpdateFlags::LightsMoved;
@@ -404,11 +661,38 @@ namespace Falcor
                 if ((lightChanges & otherChanges) != Light::Changes::None) flags |= UpdateFlags::LightPropertiesChanged;
             }
         }
+
+        uploadLights();
         return flags;
     }
 
+    void Scene::uploadLights()
+    {
+        if (mDirtyLights.empty()) return;
+
+        mLightStats.uploadedLights += mDirtyLights.getElementCount();
+        mLightStats.copies += mDirtyLights.getRanges().size();
+        mpUploadRing->uploadRanges(gpDevice->getRenderContext(), mpLightsBuffer.get(), mLightData.data(), sizeof(LightData), mDirtyLights);
+    }
+
+    void Scene::initMaterials()
+    {
+        // The material data was packed by finalize(), only the resources are bound here
+        for (uint32_t materialId = 0; materialId < (uint32_t)mMaterials.size(); ++materialId)
+        {
+            mMaterials[materialId]->clearUpdates();
+            mDirtyMaterials.mark(materialId);
+            bindMaterialResources(materialId);
+        }
+
+        uploadMaterials();
+        Material::clearGlobalUpdates();
+    }
+
     Scene::UpdateFlags Scene::updateMaterials(bool forceUpdate)
     {
+        PROFILE("updateMaterials");
+
         UpdateFlags flags = UpdateFlags::None;
 
         // Early out if no materials have changed
@@ -421,11 +705,17 @@ namespace Falcor
             if (forceUpdate || materialUpdates != Material::UpdateFlags::None)
             {
                 material->clearUpdates();
-                uploadMaterial(materialId);
+                mMaterialData[materialId] = material->getData();
+                mDirtyMaterials.mark(materialId);
+
+                // Texture and sampler bindings only change with the material's resources
+                if (forceUpdate || is_set(materialUpdates, Material::UpdateFlags::ResourcesChanged)) bindMaterialResources(materialId);
                 flags |= UpdateFlags::MaterialsChanged;
             }
         }
 
+        uploadMaterials();
+
         Material::clearGlobalUpdates();
 
         return flags;
@@ -434,6 +724,7 @@ namespace Falcor
     Scene::UpdateFlags Scene::update(RenderContext* pContext, double currentTime)
     {
         mUpdates = UpdateFlags::None;
+        mpUploadRing->beginFrame(pContext);
         if (mpAnimationController->animate(pContext, currentTime))
         {
             mUpdates |= UpdateFlags::SceneGraphChanged;
@@ -449,17 +740,27 @@ namespace Falcor
         mUpdates |= updateCamera(false);
         mUpdates |= updateLights(false);
         mUpdates |= updateMaterials(false);
-        pContext->flush();
+
+        // Only set to compare frame pacing against the submit update() used to do here
+        if (sFlushAfterUpdate) pContext->flush();
+
         if (is_set(mUpdates, UpdateFlags::MeshesMoved))
         {
-            mTlasCache.clear();
-            updateMeshInstanceFlags();
+            markInstanceDescsDirty();
+            if (updateMeshInstanceFlags())
+            {
+                mpUploadRing->upload(pContext, mpMeshInstancesBuffer.get(), 0, mMeshInstanceData.data(), sizeof(MeshInstanceData) * mMeshInstanceData.size());
+                uploadDrawLists(pContext);
+            }
+
+            PROFILE("updateBounds");
+            updateBounds();
         }
 
         // If a transform in the scene changed, update BLASes with skinned meshes
         if (mBlasData.size() && mHasSkinnedMesh && is_set(mUpdates, UpdateFlags::SceneGraphChanged))
         {
-            mTlasCache.clear();
+            mTlasEpoch++;
             buildBlas(pContext);
         }
 
@@ -553,6 +854,20 @@ namespace Falcor
                 << "Material count: " << getMaterialCount() << std::endl
                 << "Analytic light count: " << getLightCount() << std::endl
                 << "Light probe count: " << lightProbeCount << std::endl;
+
+            if (!mBlasData.empty())
+            {
+                const double kMB = 1024.0 * 1024.0;
+                oss << "BLAS count: " << mBlasData.size() << " (" << mBlasStats.compactedCount << " compacted)" << std::endl
+                    << "BLAS memory before compaction: " << mBlasStats.uncompactedBytes / kMB << " MB" << std::endl
+                    << "BLAS memory after compaction: " << mBlasStats.currentBytes / kMB << " MB" << std::endl
+                    << "BLAS arena: " << mBlasArena.getReservedBytes() / kMB << " MB reserved in " << mBlasArena.getPageCount() << " pages" << std::endl
+                    << "BLAS quality rebuilds: " << mBlasStats.qualityRebuildCount << std::endl
+                    << "BLAS grouping cost (SAH estimate): " << mBlasStats.groupingCost << std::endl
+                    << "TLAS count: " << (mTlas.pTlas ? 1 : 0) + mTlasCache.size() << " (hit group stride " << mTlasHitGroupStride << ")" << std::endl
+                    << "TLAS instance descs uploaded: " << mTlasStats.uploadedInstanceDescs << " in " << mTlasStats.instanceDescCopies << " copies" << std::endl;
+            }
+            oss << "Lights uploaded: " << mLightStats.uploadedLights << " in " << mLightStats.copies << " copies" << std::endl;
             statsGroup.text(oss.str());
 
             if (mpLightCollection)
@@ -659,40 +974,81 @@ namespace Falcor
 
     void Scene::createDrawList()
     {
-        std::vector<D3D12_DRAW_INDEXED_ARGUMENTS> drawClockwiseMeshes, drawCounterClockwiseMeshes;
-        auto pMatricesBuffer = mpSceneBlock->getBuffer("worldMatrices");
-        const glm::mat4* matrices = (glm::mat4*)pMatricesBuffer->map(Buffer::MapType::Read); // #SCENEV2 This will cause the pipeline to flush and sync, but it's probably not too bad as this only happens once
-
-        for (const auto& instance : mMeshInstanceData)
+        // The winding of each instance comes from the flags computed on the CPU by updateMeshInstanceFlags()
+        if (mMeshInstanceData.empty()) return;
+        assert(mMeshInstanceData.size() <= UINT32_MAX);
+        mDrawClockwiseMeshes.args.clear();
+        mDrawCounterClockwiseMeshes.args.clear();
+        mDrawListSlots.resize(mMeshInstanceData.size());
+
+        for (uint32_t instanceID = 0; instanceID < (uint32_t)mMeshInstanceData.size(); instanceID++)
         {
+            const auto& instance = mMeshInstanceData[instanceID];
             const auto& mesh = mMeshDesc[instance.meshID];
-            const auto& transform = matrices[instance.globalMatrixID];
 
             D3D12_DRAW_INDEXED_ARGUMENTS draw;
             draw.IndexCountPerInstance = mesh.indexCount;
             draw.InstanceCount = 1;
             draw.StartIndexLocation = mesh.ibOffset;
             draw.BaseVertexLocation = mesh.vbOffset;
-            draw.StartInstanceLocation = (uint32_t)(drawClockwiseMeshes.size() + drawCounterClockwiseMeshes.size());
+            draw.StartInstanceLocation = instanceID;
 
-            (doesTransformFlip(transform)) ? drawClockwiseMeshes.push_back(draw) : drawCounterClockwiseMeshes.push_back(draw);
+            auto& drawList = is_set(instance.flags, MeshInstanceFlags::Flipped) ? mDrawClockwiseMeshes : mDrawCounterClockwiseMeshes;
+            mDrawListSlots[instanceID] = (uint32_t)drawList.args.size();
+            drawList.args.push_back(draw);
         }
 
-        // Create the draw-indirect buffer
-        if (drawCounterClockwiseMeshes.size())
+        // Create the draw-indirect buffers. Instances can change winding when animated, so each buffer has room for all of them.
+        // The culling pass reads the full lists and writes the visible draws to the culled buffers.
+        size_t argsSize = sizeof(D3D12_DRAW_INDEXED_ARGUMENTS) * mMeshInstanceData.size();
+        for (auto pDrawList : { &mDrawClockwiseMeshes, &mDrawCounterClockwiseMeshes })
         {
-            mDrawCounterClockwiseMeshes.pBuffer = Buffer::create(sizeof(drawCounterClockwiseMeshes[0]) * drawCounterClockwiseMeshes.size(), Resource::BindFlags::IndirectArg, Buffer::CpuAccess::None, drawCounterClockwiseMeshes.data());
-            mDrawCounterClockwiseMeshes.count = (uint32_t)drawCounterClockwiseMeshes.size();
+            pDrawList->count = (uint32_t)pDrawList->args.size();
+            pDrawList->dirty.clear();
+            pDrawList->pBuffer = Buffer::create(argsSize, Resource::BindFlags::IndirectArg | Resource::BindFlags::ShaderResource, Buffer::CpuAccess::None);
+            if (pDrawList->count) pDrawList->pBuffer->setBlob(pDrawList->args.data(), 0, sizeof(D3D12_DRAW_INDEXED_ARGUMENTS) * pDrawList->count);
+            pDrawList->pCulledBuffer = Buffer::create(argsSize, Resource::BindFlags::IndirectArg | Resource::BindFlags::UnorderedAccess, Buffer::CpuAccess::None);
         }
 
-        if (drawClockwiseMeshes.size())
+        mCulling.pVisibleCount = Buffer::create(2 * sizeof(uint32_t), Resource::BindFlags::IndirectArg | Resource::BindFlags::UnorderedAccess, Buffer::CpuAccess::None);
+        mCulling.pInstanceBounds = Buffer::createStructured(sizeof(float4), (uint32_t)mMeshInstanceData.size() * 2, Resource::BindFlags::ShaderResource, Buffer::CpuAccess::None, nullptr, false);
+        mCulling.pViewMasks = Buffer::createStructured(sizeof(uint32_t), (uint32_t)mMeshInstanceData.size(), Resource::BindFlags::ShaderResource | Resource::BindFlags::UnorderedAccess, Buffer::CpuAccess::None, nullptr, false);
+        mCulling.pInstanceMasks = Buffer::createStructured(sizeof(uint32_t), (uint32_t)mMeshInstanceData.size(), Resource::BindFlags::ShaderResource, Buffer::CpuAccess::None, nullptr, false);
+        mCulling.masksDirty = true;
+    }
+
+    void Scene::moveDraw(uint32_t instanceID, bool flipped)
+    {
+        auto& from = flipped ? mDrawCounterClockwiseMeshes : mDrawClockwiseMeshes;
+        auto& to = flipped ? mDrawClockwiseMeshes : mDrawCounterClockwiseMeshes;
+
+        // Fill the hole with the last draw of the list. StartInstanceLocation is the instance ID, so the moved draw's slot can be updated.
+        uint32_t slot = mDrawListSlots[instanceID];
+        uint32_t last = (uint32_t)from.args.size() - 1;
+        D3D12_DRAW_INDEXED_ARGUMENTS draw = from.args[slot];
+        if (slot != last)
         {
-            mDrawClockwiseMeshes.pBuffer = Buffer::create(sizeof(drawClockwiseMeshes[0]) * drawClockwiseMeshes.size(), Resource::BindFlags::IndirectArg, Buffer::CpuAccess::None, drawClockwiseMeshes.data());
-            mDrawClockwiseMeshes.count = (uint32_t)drawClockwiseMeshes.size();
+            from.args[slot] = from.args[last];
+            mDrawListSlots[from.args[slot].StartInstanceLocation] = slot;
+            from.dirty.mark(slot);
         }
+        from.args.pop_back();
+        from.count = (uint32_t)from.args.size();
+
+        mDrawListSlots[instanceID] = (uint32_t)to.args.size();
+        to.dirty.mark((uint32_t)to.args.size());
+        to.args.push_back(draw);
+        to.count = (uint32_t)to.args.size();
+    }
 
-        size_t drawCount = drawClockwiseMeshes.size() + drawCounterClockwiseMeshes.size();
-        assert(drawCount <= UINT32_MAX);
+    void Scene::uploadDrawLists(RenderContext* pContext)
+    {
+        for (auto pDrawList : { &mDrawClockwiseMeshes, &mDrawCounterClockwiseMeshes })
+        {
+            // A slot appended and then popped again by a later move in the same update is still marked, but is past the end of the list now
+            pDrawList->dirty.clamp((uint32_t)pDrawList->args.size());
+            mpUploadRing->uploadRanges(pContext, pDrawList->pBuffer.get(), pDrawList->args.data(), sizeof(D3D12_DRAW_INDEXED_ARGUMENTS), pDrawList->dirty);
+        }
     }
 
     void Scene::sortMeshes()
@@ -704,81 +1060,136 @@ namespace Falcor
         // can therefore be directly indexed by [InstanceID() + GeometryIndex()].
         // This avoids the need to have a lookup table from hit IDs to mesh instance.
 
-        // Build a list of mesh instance indices per mesh.
-        std::vector<std::vector<size_t>> instanceLists(mMeshDesc.size());
-        for (size_t i = 0; i < mMeshInstanceData.size(); i++)
+        // This should currently only be run on scene initialization.
+        assert(mMeshGroups.empty());
+
+        // Non-instanced meshes are grouped by the global matrix ID of their transform, meshes that have multiple instances go in their own groups.
+        // With the spatial policy, groups over the triangle budget are then split. See MeshGrouping.h.
+        auto startTime = std::chrono::high_resolution_clock::now();
+        std::vector<uint32_t> meshTriangleCounts = getTriangleCounts(mMeshDesc);
+        computeMeshMasks();
+        bool cached = !sSceneCacheOptions.path.empty() && openSceneCache();
+        if (!cached)
         {
-            assert(mMeshInstanceData[i].meshID < instanceLists.size());
-            instanceLists[mMeshInstanceData[i].meshID].push_back(i);
+            mMeshGrouping = MeshGrouping::group((uint32_t)mMeshDesc.size(), mMeshInstanceData, mMeshBBs, meshTriangleCounts, mMeshMasks, sMeshGroupingOptions);
+            if (mSceneCache.pWriter)
+            {
+                auto& writer = *mSceneCache.pWriter;
+                writer.addSection(SceneCache::Section::GroupOffsets, mMeshGrouping.groupOffsets);
+                writer.addSection(SceneCache::Section::GroupMeshes, mMeshGrouping.groupMeshes);
+                writer.addSection(SceneCache::Section::InstanceOrder, mMeshGrouping.instanceOrder);
+                writer.addSection(SceneCache::Section::MeshFirstInstance, mMeshGrouping.meshFirstInstance);
+                writer.addSection(SceneCache::Section::MeshInstanceCount, mMeshGrouping.meshInstanceCount);
+            }
         }
+        const auto& grouping = mMeshGrouping;
 
-        // The non-instanced meshes are grouped based on what global matrix ID their transform is.
-        std::unordered_map<uint32_t, std::vector<uint32_t>> nodeToMeshList;
-        for (uint32_t meshId = 0; meshId < (uint32_t)instanceLists.size(); meshId++)
+        mMeshGroups.resize(grouping.getGroupCount());
+        for (uint32_t g = 0; g < grouping.getGroupCount(); g++)
         {
-            const auto& instanceList = instanceLists[meshId];
-            if (instanceList.size() > 1) continue; // Only processing non-instanced meshes here
-
-            assert(instanceList.size() == 1);
-            uint32_t globalMatrixId = mMeshInstanceData[instanceList[0]].globalMatrixID;
-            nodeToMeshList[globalMatrixId].push_back(meshId);
+            mMeshGroups[g].meshList.assign(grouping.groupMeshes.begin() + grouping.groupOffsets[g], grouping.groupMeshes.begin() + grouping.groupOffsets[g + 1]);
         }
 
-        // Build final result. Format is a list of Mesh ID's per mesh group.
-
-        // This should currently only be run on scene initialization.
-        assert(mMeshGroups.empty());
-
-        // Non-instanced meshes were sorted above so just copy each list.
-        for (const auto& it : nodeToMeshList) mMeshGroups.push_back({ it.second });
+        // Reorder mMeshInstanceData in place. instanceOrder lists the existing instances in the order they appear in the mesh groups.
+        // Instances loaded from the scene cache are already sorted.
+        assert(grouping.instanceOrder.size() == mMeshInstanceData.size());
+        if (!cached) MeshGrouping::applyPermutation(mMeshInstanceData, grouping.instanceOrder);
 
-        // Meshes that have multiple instances go in their own groups.
-        for (uint32_t meshId = 0; meshId < (uint32_t)instanceLists.size(); meshId++)
+        // Create mapping of meshes to their instances. The instances of a mesh are contiguous after the reordering.
+        mMeshIdToInstanceIds.clear();
+        mMeshIdToInstanceIds.resize(mMeshDesc.size());
+        parallelFor(mMeshDesc.size(), 4096, [&](size_t begin, size_t end)
         {
-            const auto& instanceList = instanceLists[meshId];
-            if (instanceList.size() == 1) continue; // Only processing instanced meshes here
-            mMeshGroups.push_back({ std::vector<uint32_t>({ meshId }) });
-        }
+            for (size_t meshId = begin; meshId < end; meshId++)
+            {
+                auto& instanceIds = mMeshIdToInstanceIds[meshId];
+                instanceIds.resize(grouping.meshInstanceCount[meshId]);
+                for (uint32_t i = 0; i < grouping.meshInstanceCount[meshId]; i++) instanceIds[i] = grouping.meshFirstInstance[meshId] + i;
+            }
+        });
+
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+        logInfo("Sorted " + std::to_string(mMeshInstanceData.size()) + " mesh instances into " + std::to_string(mMeshGroups.size()) + " mesh groups in " + std::to_string(ms) + " ms");
+    }
 
-        // Calculate mapping from new mesh instance ID to existing instance index.
-        // Here, just append existing instance ID's in order they appear in the mesh groups.
-        std::vector<size_t> instanceMapping;
-        for (const auto& meshGroup : mMeshGroups)
+    bool Scene::openSceneCache()
+    {
+        // The cache file is keyed by the scene source and the grouping options.
+        // The scene data before sorting is checked too, so a cache written by a different builder is not used.
+        mSceneCache.key = SceneCache::hashBytes(&sMeshGroupingOptions, sizeof(sMeshGroupingOptions), sSceneCacheOptions.key);
+        uint64_t sourceState = SceneCache::hashBytes(mMeshInstanceData.data(), mMeshInstanceData.size() * sizeof(MeshInstanceData));
+        sourceState = SceneCache::hashBytes(mMeshBBs.data(), mMeshBBs.size() * sizeof(BoundingBox), sourceState);
+        sourceState = SceneCache::hashBytes(mMeshMasks.data(), mMeshMasks.size() * sizeof(mMeshMasks[0]), sourceState);
+        std::vector<uint64_t> sourceStateSection = { sourceState };
+
+        mSceneCache.pReader = SceneCache::Reader::open(sSceneCacheOptions.path, mSceneCache.key);
+        if (mSceneCache.pReader)
         {
-            for (const uint32_t meshId : meshGroup.meshList)
+            const auto& reader = *mSceneCache.pReader;
+            MeshGrouping::Result grouping;
+            std::vector<MeshInstanceData> instances;
+            bool valid = reader.matchesSection(SceneCache::Section::SourceState, sourceStateSection)
+                && reader.matchesSection(SceneCache::Section::MeshDescs, mMeshDesc)
+                && reader.readSection(SceneCache::Section::MeshInstances, instances)
+                && reader.readSection(SceneCache::Section::GroupOffsets, grouping.groupOffsets)
+                && reader.readSection(SceneCache::Section::GroupMeshes, grouping.groupMeshes)
+                && reader.readSection(SceneCache::Section::InstanceOrder, grouping.instanceOrder)
+                && reader.readSection(SceneCache::Section::MeshFirstInstance, grouping.meshFirstInstance)
+                && reader.readSection(SceneCache::Section::MeshInstanceCount, grouping.meshInstanceCount);
+
+            valid = valid && instances.size() == mMeshInstanceData.size() && grouping.instanceOrder.size() == mMeshInstanceData.size()
+                && grouping.meshFirstInstance.size() == mMeshDesc.size() && grouping.meshInstanceCount.size() == mMeshDesc.size()
+                && !grouping.groupOffsets.empty() && grouping.groupOffsets.back() == grouping.groupMeshes.size();
+
+            if (valid)
             {
-                const auto& instanceList = instanceLists[meshId];
-                for (size_t idx : instanceList)
-                {
-                    instanceMapping.push_back(idx);
-                }
+                mMeshGrouping = std::move(grouping);
+                mMeshInstanceData = std::move(instances);
+                logInfo("Loaded the sorted scene data from the scene cache '" + sSceneCacheOptions.path + "'");
+                return true;
             }
+
+            mSceneCache.pReader = nullptr;
+            logWarning("The scene cache '" + sSceneCacheOptions.path + "' doesn't match the scene and will be rewritten");
         }
-        assert(instanceMapping.size() == mMeshInstanceData.size());
-        {
-            // Check that all indices exist
-            std::set<size_t> instanceIndices(instanceMapping.begin(), instanceMapping.end());
-            assert(instanceIndices.size() == mMeshInstanceData.size());
-        }
 
-        // Now reorder mMeshInstanceData based on the new mapping.
-        // We'll make a copy of the existing data first, and the populate the array.
-        std::vector<MeshInstanceData> prevInstanceData = mMeshInstanceData;
-        for (size_t i = 0; i < mMeshInstanceData.size(); i++)
+        // The sections computed while loading are collected and written at the end of finalize()
+        mSceneCache.pWriter = std::make_unique<SceneCache::Writer>();
+        mSceneCache.pWriter->addSection(SceneCache::Section::SourceState, sourceStateSection);
+        mSceneCache.pWriter->addSection(SceneCache::Section::MeshDescs, mMeshDesc);
+        return false;
+    }
+
+    void Scene::writeSceneCache()
+    {
+        if (mSceneCache.pWriter)
         {
-            assert(instanceMapping[i] < prevInstanceData.size());
-            mMeshInstanceData[i] = prevInstanceData[instanceMapping[i]];
+            mSceneCache.pWriter->addSection(SceneCache::Section::MeshInstances, mMeshInstanceData);
+            mSceneCache.pWriter->addSection(SceneCache::Section::Materials, mMaterialData);
+            if (mSceneCache.pWriter->write(sSceneCacheOptions.path, mSceneCache.key)) logInfo("Wrote the scene cache '" + sSceneCacheOptions.path + "'");
+            else logWarning("Failed to write the scene cache '" + sSceneCacheOptions.path + "'");
         }
 
-        // Create mapping of meshes to their instances.
-        mMeshIdToInstanceIds.clear();
-        mMeshIdToInstanceIds.resize(mMeshDesc.size());
-        for (uint32_t instId = 0; instId < (uint32_t)mMeshInstanceData.size(); instId++)
+        // Static BLASes are loaded from or added to the cache on the first BLAS build, otherwise the cache isn't needed anymore
+        mSceneCache.blasPending = !sSceneCacheOptions.path.empty() && sSceneCacheOptions.cacheBlas;
+        if (!mSceneCache.blasPending)
         {
-            mMeshIdToInstanceIds[mMeshInstanceData[instId].meshID].push_back(instId);
+            mSceneCache.pReader = nullptr;
+            mSceneCache.pWriter = nullptr;
         }
     }
 
+    void Scene::estimateMeshGroupingCost()
+    {
+        // The grouping is only kept around until the instance bounds exist
+        std::vector<uint32_t> meshTriangleCounts = getTriangleCounts(mMeshDesc);
+        std::vector<BoundingBox> instanceBounds(mMeshInstanceData.size());
+        for (size_t i = 0; i < instanceBounds.size(); i++) instanceBounds[i] = mInstanceBounds.get(i);
+
+        mBlasStats.groupingCost = MeshGrouping::estimateTraceCost(mMeshGrouping, meshTriangleCounts, instanceBounds);
+        mMeshGrouping = {};
+    }
+
     void Scene::initGeomDesc()
     {
         assert(mBlasData.empty());
@@ -838,10 +1249,40 @@ namespace Falcor
         pContext->resourceBarrier(pVb.get(), Resource::State::NonPixelShader);
         pContext->resourceBarrier(pIb.get(), Resource::State::NonPixelShader);
 
+        GET_COM_INTERFACE(gpDevice->getApiHandle(), ID3D12Device5, pDevice5);
+
+        // On the first build, static BLASes are deserialized from the scene cache if it has them, otherwise they are added to it after the build
+        bool serializeToCache = false;
+        if (mSceneCache.blasPending)
+        {
+            mSceneCache.blasPending = false;
+            serializeToCache = !loadCachedBlas(pContext);
+            if (!serializeToCache)
+            {
+                mSceneCache.pReader = nullptr;
+                mSceneCache.pWriter = nullptr;
+            }
+        }
+
+        // Refit BLASes whose quality degraded too much are rebuilt instead
+        std::vector<uint32_t> rebuildList = selectBlasRebuilds();
+
+        // Uncompacted static BLASes only live until compaction, so they are allocated from a temporary arena.
+        // This keeps them from fragmenting the pages that hold the final BLASes.
+        AccelerationStructureArena buildArena;
+
+        // Static BLASes are built once, so they are built for fast trace and compacted after the build.
+        std::vector<uint32_t> buildList;
+        std::vector<uint32_t> compactionList;
+        std::vector<D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS> buildInputs;
+        std::vector<uint64_t> scratchSizes;
+
         // For each BLAS
-        for (auto& blas : mBlasData)
+        for (uint32_t blasID = 0; blasID < (uint32_t)mBlasData.size(); blasID++)
         {
-            if (blas.pBlas != nullptr && !blas.hasSkinnedMesh) continue; // Skip updating BLASes not containing skinned meshes
+            auto& blas = mBlasData[blasID];
+            bool firstBuild = !blas.blasAllocation.isValid();
+            if (!firstBuild && !blas.hasSkinnedMesh) continue; // Skip updating BLASes not containing skinned meshes
 
             // Setup build parameters and get prebuild info
             D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS inputs = {};
@@ -850,60 +1291,336 @@ namespace Falcor
             inputs.NumDescs = (uint32_t)blas.geomDescs.size();
             inputs.pGeometryDescs = blas.geomDescs.data();
             inputs.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_NONE;
+            if (!blas.hasSkinnedMesh) inputs.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE | D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_COMPACTION;
 
             // Determine if this BLAS is, or will be refit, and add necessary flags
+            bool scheduledRebuild = std::binary_search(rebuildList.begin(), rebuildList.end(), blasID);
             if (blas.hasSkinnedMesh && mBlasUpdateMode == UpdateMode::Refit)
             {
                 inputs.Flags |= D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE; // Subsequent updates need this flag too
 
-                // Refit if BLAS exists, and it was previously created with ALLOW_UPDATE
-                if (blas.pBlas != nullptr && blas.updateMode == UpdateMode::Refit) inputs.Flags |= D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE;
+                // Refit if BLAS exists, and it was previously created with ALLOW_UPDATE, unless it is scheduled for a rebuild
+                if (!firstBuild && blas.updateMode == UpdateMode::Refit && !scheduledRebuild) inputs.Flags |= D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE;
+            }
+
+            // Track the quality of skinned BLASes
+            if (blas.hasSkinnedMesh)
+            {
+                if ((inputs.Flags & D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE) > 0)
+                {
+                    blas.refitCount++;
+                }
+                else
+                {
+                    if (scheduledRebuild) mBlasStats.qualityRebuildCount++;
+
+                    // Other builds reach every skinned BLAS in the same frame: the first build, Rebuild mode and switching back to Refit.
+                    // Starting their refit counts at different values keeps the rebuilds that follow from landing on the same frame.
+                    blas.refitCount = scheduledRebuild ? 0 : blasID % kBlasMaxRefits;
+                }
             }
 
-            // Allocate scratch and BLAS buffers on the first build
-            if (blas.pBlas == nullptr)
+            // Allocate BLAS memory on the first build
+            if (firstBuild)
             {
-                GET_COM_INTERFACE(gpDevice->getApiHandle(), ID3D12Device5, pDevice5);
                 pDevice5->GetRaytracingAccelerationStructurePrebuildInfo(&inputs, &blas.prebuildInfo);
 
                 // #SCENE This isn't guaranteed according to the spec, and the scratch buffer being stored should be sized differently depending on update mode
                 assert(blas.prebuildInfo.UpdateScratchDataSizeInBytes <= blas.prebuildInfo.ScratchDataSizeInBytes);
 
-                blas.pScratchBuffer = Buffer::create(blas.prebuildInfo.ScratchDataSizeInBytes, Buffer::BindFlags::UnorderedAccess, Buffer::CpuAccess::None);
-                blas.pBlas = Buffer::create(blas.prebuildInfo.ResultDataMaxSizeInBytes, Buffer::BindFlags::AccelerationStructure, Buffer::CpuAccess::None);
+                auto& arena = blas.hasSkinnedMesh ? mBlasArena : buildArena;
+                blas.blasAllocation = arena.allocate(blas.prebuildInfo.ResultDataMaxSizeInBytes);
+                if (!blas.hasSkinnedMesh) compactionList.push_back(blasID);
+
+                mBlasStats.uncompactedBytes += blas.prebuildInfo.ResultDataMaxSizeInBytes;
+                mBlasStats.currentBytes += blas.prebuildInfo.ResultDataMaxSizeInBytes;
             }
-            // For any rebuild and refits, just add a barrier
-            else
+
+            scratchSizes.push_back(blas.prebuildInfo.ScratchDataSizeInBytes);
+            buildList.push_back(blasID);
+            buildInputs.push_back(inputs);
+        }
+
+        if (serializeToCache && compactionList.empty())
+        {
+            // Only skinned BLASes, there is nothing to cache
+            serializeToCache = false;
+            mSceneCache.pReader = nullptr;
+            mSceneCache.pWriter = nullptr;
+        }
+
+        if (buildList.empty()) return;
+
+        auto startTime = std::chrono::high_resolution_clock::now();
+
+        // Builds in a batch use disjoint ranges of the scratch buffer, so they are independent and only need a barrier after the batch
+        BlasBuildPlanner planner;
+        planner.plan(scratchSizes, kBlasScratchBudget, D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT);
+        if (mpBlasScratch == nullptr || mpBlasScratch->getSize() < planner.getScratchBufferSize())
+        {
+            mpBlasScratch = Buffer::create(planner.getScratchBufferSize(), Buffer::BindFlags::UnorderedAccess, Buffer::CpuAccess::None);
+        }
+
+        // The compacted size of each static BLAS is written by its build into pCompactedSizes
+        Buffer::SharedPtr pCompactedSizes;
+        if (!compactionList.empty())
+        {
+            pCompactedSizes = Buffer::create(compactionList.size() * sizeof(uint64_t), Buffer::BindFlags::UnorderedAccess, Buffer::CpuAccess::None);
+            pContext->resourceBarrier(pCompactedSizes.get(), Resource::State::UnorderedAccess);
+        }
+
+        GET_COM_INTERFACE(pContext->getLowLevelData()->getCommandList(), ID3D12GraphicsCommandList4, pList4);
+        size_t compactionIndex = 0;
+        std::vector<const Buffer*> batchBuffers;
+        for (const auto& batch : planner.getBatches())
+        {
+            // Collect the buffers written by the batch. BLASes share arena pages, so there are usually only a few.
+            batchBuffers.assign(1, mpBlasScratch.get());
+            for (size_t i = batch.firstBuild; i < batch.firstBuild + batch.buildCount; i++) batchBuffers.push_back(mBlasData[buildList[i]].blasAllocation.pBuffer.get());
+            std::sort(batchBuffers.begin(), batchBuffers.end());
+            batchBuffers.erase(std::unique(batchBuffers.begin(), batchBuffers.end()), batchBuffers.end());
+
+            // Previous work on the scratch buffer and on the BLASes must be done
+            for (const Buffer* pBuffer : batchBuffers) pContext->uavBarrier(pBuffer);
+
+            for (size_t i = batch.firstBuild; i < batch.firstBuild + batch.buildCount; i++)
             {
-                assert(blas.pScratchBuffer != nullptr);
+                auto& blas = mBlasData[buildList[i]];
+                const auto& inputs = buildInputs[i];
 
-                pContext->uavBarrier(blas.pBlas.get());
-                pContext->uavBarrier(blas.pScratchBuffer.get());
+                // Build BLAS
+                D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC asDesc = {};
+                asDesc.Inputs = inputs;
+                asDesc.ScratchAccelerationStructureData = mpBlasScratch->getGpuAddress() + planner.getScratchOffset(i);
+                asDesc.DestAccelerationStructureData = blas.blasAllocation.getGpuAddress();
+
+                // Set buffer address to update in place if this is a refit
+                if ((inputs.Flags & D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE) > 0) asDesc.SourceAccelerationStructureData = asDesc.DestAccelerationStructureData;
+
+                if (compactionIndex < compactionList.size() && compactionList[compactionIndex] == buildList[i])
+                {
+                    D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_DESC postbuildDesc = {};
+                    postbuildDesc.InfoType = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_COMPACTED_SIZE;
+                    postbuildDesc.DestBuffer = pCompactedSizes->getGpuAddress() + compactionIndex * sizeof(uint64_t);
+                    pList4->BuildRaytracingAccelerationStructure(&asDesc, 1, &postbuildDesc);
+                    compactionIndex++;
+                }
+                else
+                {
+                    pList4->BuildRaytracingAccelerationStructure(&asDesc, 0, nullptr);
+                }
+
+                if (blas.hasSkinnedMesh) blas.updateMode = mBlasUpdateMode;
             }
 
-            // Build BLAS
-            D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC asDesc = {};
-            asDesc.Inputs = inputs;
-            asDesc.ScratchAccelerationStructureData = blas.pScratchBuffer->getGpuAddress();
-            asDesc.DestAccelerationStructureData = blas.pBlas->getGpuAddress();
+            // One UAV barrier per buffer written by the batch
+            for (const Buffer* pBuffer : batchBuffers) pContext->uavBarrier(pBuffer);
+        }
+
+        // Report the cost of the initial build. Skinned updates are covered by the buildBlas profiler scope.
+        if (!compactionList.empty())
+        {
+            pContext->flush(true);
+            double buildTimeMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+            logInfo("Scene: built " + std::to_string(buildList.size()) + " BLASes in " + std::to_string(planner.getBatches().size()) + " batches, "
+                + std::to_string(planner.getScratchBufferSize() / (1024 * 1024)) + " MB scratch, " + std::to_string(buildTimeMs) + " ms");
+        }
+
+        if (!compactionList.empty()) compactBlas(pContext, compactionList, pCompactedSizes);
+        if (serializeToCache) serializeBlas(pContext, compactionList);
+
+        // Only skinned BLASes are built again, so there is no need to keep the scratch memory otherwise
+        if (!mHasSkinnedMesh) mpBlasScratch = nullptr;
+    }
+
+    std::vector<uint32_t> Scene::selectBlasRebuilds() const
+    {
+        std::vector<uint32_t> rebuildList;
+        if (mBlasUpdateMode != UpdateMode::Refit) return rebuildList;
+
+        // Skinned vertices are not available on the CPU, so the quality of a refit BLAS is tracked by its refit count alone
+        std::vector<std::pair<uint32_t, uint32_t>> due;
+        for (uint32_t blasID = 0; blasID < (uint32_t)mBlasData.size(); blasID++)
+        {
+            const auto& blas = mBlasData[blasID];
+            if (!blas.hasSkinnedMesh || !blas.blasAllocation.isValid() || blas.updateMode != UpdateMode::Refit) continue;
+            if (blas.refitCount >= kBlasMaxRefits) due.push_back({ blas.refitCount, blasID });
+        }
+
+        // Rebuild the most refit ones and leave the others for the next frames, so rebuild cost is spread out
+        size_t count = std::min(due.size(), kMaxBlasRebuildsPerFrame);
+        std::partial_sort(due.begin(), due.begin() + count, due.end(), std::greater<std::pair<uint32_t, uint32_t>>());
+        for (size_t i = 0; i < count; i++) rebuildList.push_back(due[i].second);
+        std::sort(rebuildList.begin(), rebuildList.end());
+        return rebuildList;
+    }
+
+    void Scene::compactBlas(RenderContext* pContext, const std::vector<uint32_t>& blasIDs, const Buffer::SharedPtr& pCompactedSizes)
+    {
+        PROFILE("compactBlas");
+
+        // Read back the compacted sizes. This waits for the builds to finish, which is acceptable as static BLASes are only built once.
+        std::vector<uint64_t> compactedSizes = readBuffer<uint64_t>(pContext, pCompactedSizes);
+        assert(compactedSizes.size() == blasIDs.size());
+
+        // Copy each BLAS into a tightly sized arena allocation. The uncompacted pages are released once the GPU is done with them.
+        GET_COM_INTERFACE(pContext->getLowLevelData()->getCommandList(), ID3D12GraphicsCommandList4, pList4);
+        for (size_t i = 0; i < blasIDs.size(); i++)
+        {
+            auto& blas = mBlasData[blasIDs[i]];
+            assert(compactedSizes[i] > 0 && compactedSizes[i] <= blas.prebuildInfo.ResultDataMaxSizeInBytes);
+
+            AccelerationStructureArena::Allocation compacted = mBlasArena.allocate(compactedSizes[i]);
+            pList4->CopyRaytracingAccelerationStructure(compacted.getGpuAddress(), blas.blasAllocation.getGpuAddress(), D3D12_RAYTRACING_ACCELERATION_STRUCTURE_COPY_MODE_COMPACT);
 
-            // Set buffer address to update in place if this is a refit
-            if ((inputs.Flags & D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE) > 0) asDesc.SourceAccelerationStructureData = asDesc.DestAccelerationStructureData;
+            mBlasStats.currentBytes -= blas.prebuildInfo.ResultDataMaxSizeInBytes - compactedSizes[i];
+            mBlasStats.compactedCount++;
+            blas.blasAllocation = compacted;
+        }
 
+        for (uint32_t blasID : blasIDs) pContext->uavBarrier(mBlasData[blasID].blasAllocation.pBuffer.get());
+    }
+
+    bool Scene::loadCachedBlas(RenderContext* pContext)
+    {
+        if (!mSceneCache.pReader) return false;
+        const auto& reader = *mSceneCache.pReader;
+
+        // The geometry flags of the BLASes depend on the materials
+        const uint64_t* pOffsets = nullptr;
+        const uint8_t* pData = nullptr;
+        size_t offsetCount = 0, dataSize = 0;
+        if (!reader.matchesSection(SceneCache::Section::Materials, mMaterialData)) return false;
+        if (!reader.getSection(SceneCache::Section::BlasOffsets, pOffsets, offsetCount) || offsetCount != mBlasData.size() + 1) return false;
+        if (!reader.getSection(SceneCache::Section::BlasData, pData, dataSize) || pOffsets[mBlasData.size()] != dataSize) return false;
+
+        // Skinned BLASes are not cached. Serialized BLASes can only be used by a driver compatible with the one that wrote them.
+        GET_COM_INTERFACE(gpDevice->getApiHandle(), ID3D12Device5, pDevice5);
+        using SerializedHeader = D3D12_SERIALIZED_RAYTRACING_ACCELERATION_STRUCTURE_HEADER;
+        for (uint32_t blasID = 0; blasID < (uint32_t)mBlasData.size(); blasID++)
+        {
+            if (pOffsets[blasID + 1] < pOffsets[blasID]) return false;
+            uint64_t size = pOffsets[blasID + 1] - pOffsets[blasID];
+            if (mBlasData[blasID].hasSkinnedMesh != (size == 0)) return false;
+            if (size == 0) continue;
+
+            const SerializedHeader* pHeader = reinterpret_cast<const SerializedHeader*>(pData + pOffsets[blasID]);
+            if (size < sizeof(SerializedHeader) || pHeader->SerializedSizeInBytesIncludingHeader > size) return false;
+            if (pDevice5->CheckDriverMatchingIdentifier(D3D12_SERIALIZED_DATA_RAYTRACING_ACCELERATION_STRUCTURE, &pHeader->DriverMatchingIdentifier) != D3D12_DRIVER_MATCHING_IDENTIFIER_COMPATIBLE_WITH_DEVICE)
+            {
+                logInfo("The BLASes in the scene cache were written by an incompatible driver, they will be rebuilt");
+                return false;
+            }
+        }
+
+        // Each BLAS is deserialized straight from the upload ring, which is filled from the mapped cache.
+        // The work is submitted whenever half the ring is used, so staging memory stays bounded by the ring rather than the size of the cache.
+        uint64_t submitSize = mpUploadRing->getCapacity() / 2;
+        uint64_t pendingSize = 0;
+        uint32_t loadedCount = 0;
+        for (uint32_t blasID = 0; blasID < (uint32_t)mBlasData.size(); blasID++)
+        {
+            auto& blas = mBlasData[blasID];
+            if (blas.hasSkinnedMesh) continue;
+
+            const SerializedHeader* pHeader = reinterpret_cast<const SerializedHeader*>(pData + pOffsets[blasID]);
+            uint64_t size = pHeader->SerializedSizeInBytesIncludingHeader;
+            if (pendingSize > 0 && pendingSize + size > submitSize)
+            {
+                mpUploadRing->submit(pContext);
+                pendingSize = 0;
+            }
+
+            // Deserialization reads from 256 byte aligned addresses
+            UploadRing::Allocation alloc = mpUploadRing->allocate(size, D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT);
+            std::memcpy(alloc.pData, pHeader, size);
+            pendingSize += size;
+
+            blas.blasAllocation = mBlasArena.allocate(pHeader->DeserializedSizeInBytes);
             GET_COM_INTERFACE(pContext->getLowLevelData()->getCommandList(), ID3D12GraphicsCommandList4, pList4);
-            pList4->BuildRaytracingAccelerationStructure(&asDesc, 0, nullptr);
+            pList4->CopyRaytracingAccelerationStructure(blas.blasAllocation.getGpuAddress(), alloc.pBuffer->getGpuAddress() + alloc.offset, D3D12_RAYTRACING_ACCELERATION_STRUCTURE_COPY_MODE_DESERIALIZE);
+
+            mBlasStats.uncompactedBytes += pHeader->DeserializedSizeInBytes;
+            mBlasStats.currentBytes += pHeader->DeserializedSizeInBytes;
+            loadedCount++;
+        }
+
+        for (const auto& blas : mBlasData)
+        {
+            if (!blas.hasSkinnedMesh) pContext->uavBarrier(blas.blasAllocation.pBuffer.get());
+        }
+
+        logInfo("Loaded " + std::to_string(loadedCount) + " BLASes (" + std::to_string(dataSize / (1024 * 1024)) + " MB) from the scene cache");
+        return true;
+    }
+
+    void Scene::serializeBlas(RenderContext* pContext, const std::vector<uint32_t>& blasIDs)
+    {
+        PROFILE("serializeBlas");
+        GET_COM_INTERFACE(pContext->getLowLevelData()->getCommandList(), ID3D12GraphicsCommandList4, pList4);
+
+        // Query the serialized size of each BLAS
+        using SerializationDesc = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_SERIALIZATION_DESC;
+        Buffer::SharedPtr pInfo = Buffer::create(blasIDs.size() * sizeof(SerializationDesc), Buffer::BindFlags::UnorderedAccess, Buffer::CpuAccess::None);
+        pContext->resourceBarrier(pInfo.get(), Resource::State::UnorderedAccess);
+        for (size_t i = 0; i < blasIDs.size(); i++)
+        {
+            D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_DESC postbuildDesc = {};
+            postbuildDesc.InfoType = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_SERIALIZATION;
+            postbuildDesc.DestBuffer = pInfo->getGpuAddress() + i * sizeof(SerializationDesc);
+            D3D12_GPU_VIRTUAL_ADDRESS address = mBlasData[blasIDs[i]].blasAllocation.getGpuAddress();
+            pList4->EmitRaytracingAccelerationStructurePostbuildInfo(&postbuildDesc, 1, &address);
+        }
+        std::vector<SerializationDesc> infos = readBuffer<SerializationDesc>(pContext, pInfo);
+
+        // Lay out the BLASes at aligned offsets. Skinned BLASes get empty ranges.
+        std::vector<uint64_t> serializedSizes(mBlasData.size(), 0);
+        for (size_t i = 0; i < blasIDs.size(); i++) serializedSizes[blasIDs[i]] = infos[i].SerializedSizeInBytes;
 
-            // Insert a UAV barrier
-            pContext->uavBarrier(blas.pBlas.get());
+        const uint64_t alignment = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT;
+        std::vector<uint64_t> offsets(mBlasData.size() + 1, 0);
+        for (size_t blasID = 0; blasID < mBlasData.size(); blasID++)
+        {
+            offsets[blasID + 1] = offsets[blasID] + (serializedSizes[blasID] + alignment - 1) / alignment * alignment;
+        }
 
-            if (!blas.hasSkinnedMesh) blas.pScratchBuffer.reset(); // Release
-            else blas.updateMode = mBlasUpdateMode;
+        Buffer::SharedPtr pSerialized = Buffer::create(offsets.back(), Buffer::BindFlags::UnorderedAccess, Buffer::CpuAccess::None);
+        pContext->resourceBarrier(pSerialized.get(), Resource::State::UnorderedAccess);
+        for (uint32_t blasID : blasIDs)
+        {
+            pList4->CopyRaytracingAccelerationStructure(pSerialized->getGpuAddress() + offsets[blasID], mBlasData[blasID].blasAllocation.getGpuAddress(), D3D12_RAYTRACING_ACCELERATION_STRUCTURE_COPY_MODE_SERIALIZE);
+        }
+        std::vector<uint8_t> data = readBuffer<uint8_t>(pContext, pSerialized);
+
+        // If the scene data came from the cache, it is copied to the new file. The mapping must be closed before the file is replaced.
+        // Only the sections openSceneCache() validated against this load are copied. Everything else in the old file may be stale.
+        if (!mSceneCache.pWriter)
+        {
+            assert(mSceneCache.pReader);
+            mSceneCache.pWriter = std::make_unique<SceneCache::Writer>();
+            for (SceneCache::Section section : { SceneCache::Section::SourceState, SceneCache::Section::MeshDescs, SceneCache::Section::MeshInstances, SceneCache::Section::GroupOffsets,
+                SceneCache::Section::GroupMeshes, SceneCache::Section::InstanceOrder, SceneCache::Section::MeshFirstInstance, SceneCache::Section::MeshInstanceCount })
+            {
+                size_t size = 0;
+                const void* pSection = mSceneCache.pReader->getSection(section, size);
+                if (pSection) mSceneCache.pWriter->addSection(section, pSection, size);
+            }
         }
+        mSceneCache.pReader = nullptr;
+
+        // The BLAS geometry flags were derived from the current materials, which may have changed since the cache was read or finalize() ran
+        mSceneCache.pWriter->addSection(SceneCache::Section::Materials, mMaterialData);
+        mSceneCache.pWriter->addSection(SceneCache::Section::BlasOffsets, offsets);
+        mSceneCache.pWriter->addSection(SceneCache::Section::BlasData, data);
+        if (mSceneCache.pWriter->write(sSceneCacheOptions.path, mSceneCache.key)) logInfo("Added " + std::to_string(blasIDs.size()) + " BLASes (" + std::to_string(data.size() / (1024 * 1024)) + " MB) to the scene cache");
+        else logWarning("Failed to write the BLASes to the scene cache '" + sSceneCacheOptions.path + "'");
+        mSceneCache.pWriter = nullptr;
     }
 
     void Scene::fillInstanceDesc(std::vector<D3D12_RAYTRACING_INSTANCE_DESC>& instanceDescs, uint32_t rayCount, bool perMeshHitEntry)
     {
         instanceDescs.clear();
+        mInstanceDescMatrixIDs.clear();
         uint32_t instanceContributionToHitGroupIndex = 0;
         uint32_t instanceId = 0;
 
@@ -912,8 +1629,8 @@ namespace Falcor
             const auto& meshList = mMeshGroups[i].meshList;
 
             D3D12_RAYTRACING_INSTANCE_DESC desc = {};
-            desc.AccelerationStructure = mBlasData[i].pBlas->getGpuAddress();
-            desc.InstanceMask = 0xFF;
+            desc.AccelerationStructure = mBlasData[i].blasAllocation.getGpuAddress();
+            desc.InstanceMask = getMeshGroupMask((uint32_t)i);
             desc.InstanceContributionToHitGroupIndex = perMeshHitEntry ? instanceContributionToHitGroupIndex : 0;
             instanceContributionToHitGroupIndex += rayCount * (uint32_t)meshList.size();
 
@@ -932,6 +1649,7 @@ namespace Falcor
                 glm::mat4 transform4x4 = transpose(mpAnimationController->getGlobalMatrices()[matrixId]);
                 std::memcpy(desc.Transform, &transform4x4, sizeof(desc.Transform));
                 instanceDescs.push_back(desc);
+                mInstanceDescMatrixIDs.push_back(matrixId);
             }
             // If only one mesh is in the BLAS, there CAN be multiple instances of it. It is either:
             // - A non-instanced mesh that was unable to be merged with others
@@ -950,25 +1668,114 @@ namespace Falcor
                     glm::mat4 transform4x4 = transpose(mpAnimationController->getGlobalMatrices()[matrixId]);
                     std::memcpy(desc.Transform, &transform4x4, sizeof(desc.Transform));
                     instanceDescs.push_back(desc);
+                    mInstanceDescMatrixIDs.push_back(matrixId);
                 }
             }
         }
+
+        // The layout is the same for every ray count, so the dirty state carries over
+        if (mInstanceDescEpochs.size() != instanceDescs.size()) mInstanceDescEpochs.assign(instanceDescs.size(), mTlasEpoch);
     }
 
-    void Scene::buildTlas(RenderContext* pContext, uint32_t rayCount, bool perMeshHitEntry)
+    void Scene::computeMeshMasks()
     {
-        PROFILE("buildTlas");
+        // Every mesh casts shadows by default. Scripts clear the bit with setMeshInstanceMask(), e.g. for the proxy geometry of a light.
+        mMeshMasks.assign(mMeshDesc.size(), kInstanceMaskVisibleToCamera | kInstanceMaskCastsShadows);
+    }
 
-        TlasData tlas;
-        auto it = mTlasCache.find(rayCount);
-        if (it != mTlasCache.end()) tlas = it->second;
+    uint32_t Scene::getMeshGroupMask(uint32_t groupIndex) const
+    {
+        // Meshes are grouped by mask and setMeshInstanceMask() only changes meshes that have a group of their own, so all masks of a group are equal
+        uint32_t mask = 0;
+        for (uint32_t meshId : mMeshGroups[groupIndex].meshList) mask |= mMeshMasks[meshId];
+        return mask;
+    }
 
-        fillInstanceDesc(mInstanceDescs, rayCount, perMeshHitEntry);
+    bool Scene::setMeshInstanceMask(uint32_t meshID, uint32_t mask)
+    {
+        assert(meshID < mMeshMasks.size() && mask <= kInstanceMaskAll);
+        if (mMeshMasks[meshID] == mask) return true;
+
+        // A TLAS instance has one mask for its whole BLAS. Giving a mesh that shares its BLAS a mask of its own would need a new grouping,
+        // which reorders the mesh instances. The change is rejected instead, so ray traced and raster passes keep seeing the same geometry.
+        for (const auto& group : mMeshGroups)
+        {
+            if (std::find(group.meshList.begin(), group.meshList.end(), meshID) == group.meshList.end()) continue;
+            if (group.meshList.size() > 1)
+            {
+                logWarning("Scene: the instance mask of mesh " + std::to_string(meshID) + " can't be changed, it shares a BLAS with " + std::to_string(group.meshList.size() - 1) + " other meshes");
+                return false;
+            }
+            break;
+        }
+
+        mMeshMasks[meshID] = mask;
+        mCulling.masksDirty = true;
+
+        // Masks rarely change, so the TLASes are rebuilt from scratch instead of patching the instance descs
+        mTlas = {};
+        mTlasCache.clear();
+        return true;
+    }
+
+    void Scene::markInstanceDescsDirty()
+    {
+        mTlasEpoch++;
+
+        // Stamp the instance descs whose transform changed, TLASes built before this epoch need to upload them
+        for (size_t i = 0; i < mInstanceDescMatrixIDs.size(); i++)
+        {
+            if (mpAnimationController->didMatrixChanged(mInstanceDescMatrixIDs[i])) mInstanceDescEpochs[i] = mTlasEpoch;
+        }
+    }
+
+    void Scene::updateInstanceDescs(RenderContext* pContext, TlasData& tlas)
+    {
+        PROFILE("updateInstanceDescs");
+
+        const auto& globalMatrices = mpAnimationController->getGlobalMatrices();
+        size_t count = tlas.instanceDescs.size();
+        assert(mInstanceDescEpochs.size() == count);
+
+        // Patch the transforms that changed since this TLAS was built and upload each run of dirty descs with one copy.
+        // Runs separated by small gaps are merged, re-uploading a few clean descs is cheaper than another copy.
+        size_t runBegin = 0, runEnd = 0;
+        auto flushRun = [&]()
+        {
+            if (runEnd == runBegin) return;
+            mpUploadRing->upload(pContext, tlas.pInstanceDescs.get(), runBegin * sizeof(D3D12_RAYTRACING_INSTANCE_DESC), &tlas.instanceDescs[runBegin], (runEnd - runBegin) * sizeof(D3D12_RAYTRACING_INSTANCE_DESC));
+            mTlasStats.uploadedInstanceDescs += runEnd - runBegin;
+            mTlasStats.instanceDescCopies++;
+        };
+
+        for (size_t i = 0; i < count; i++)
+        {
+            if (mInstanceDescEpochs[i] <= tlas.epoch) continue;
+
+            glm::mat4 transform4x4 = transpose(globalMatrices[mInstanceDescMatrixIDs[i]]);
+            std::memcpy(tlas.instanceDescs[i].Transform, &transform4x4, sizeof(tlas.instanceDescs[i].Transform));
+
+            if (runEnd == runBegin || i > runEnd + kInstanceDescMergeGap)
+            {
+                flushRun();
+                runBegin = i;
+            }
+            runEnd = i + 1;
+        }
+        flushRun();
+    }
+
+    void Scene::buildTlas(RenderContext* pContext, TlasData& tlas, uint32_t rayCount, bool perMeshHitEntry)
+    {
+        PROFILE("buildTlas");
+
+        // Instance descs are generated once per TLAS, later builds only patch the ones that moved
+        if (tlas.pTlas == nullptr) fillInstanceDesc(tlas.instanceDescs, rayCount, perMeshHitEntry);
 
         D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS inputs = {};
         inputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL;
         inputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
-        inputs.NumDescs = (uint32_t)mInstanceDescs.size();
+        inputs.NumDescs = (uint32_t)tlas.instanceDescs.size();
         inputs.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_NONE;
 
         // Add build flags for dynamic scenes if TLAS should be updating instead of rebuilt
@@ -1003,15 +1810,15 @@ namespace Falcor
         {
             assert(tlas.pInstanceDescs == nullptr); // Instance desc should also be null if no TLAS
             tlas.pTlas = Buffer::create(mTlasPrebuildInfo.ResultDataMaxSizeInBytes, Buffer::BindFlags::AccelerationStructure, Buffer::CpuAccess::None);
-            tlas.pInstanceDescs = Buffer::create((uint32_t)mInstanceDescs.size() * sizeof(D3D12_RAYTRACING_INSTANCE_DESC), Buffer::BindFlags::None, Buffer::CpuAccess::Write, mInstanceDescs.data());
+            tlas.pInstanceDescs = Buffer::create((uint32_t)tlas.instanceDescs.size() * sizeof(D3D12_RAYTRACING_INSTANCE_DESC), Buffer::BindFlags::None, Buffer::CpuAccess::None, tlas.instanceDescs.data());
         }
-        // Else update instance descs and barrier TLAS buffers
+        // Else upload the instance descs that changed and barrier TLAS buffers
         else
         {
             assert(mpAnimationController->hasAnimations());
             pContext->uavBarrier(tlas.pTlas.get());
             pContext->uavBarrier(mpTlasScratch.get());
-            tlas.pInstanceDescs->setBlob(mInstanceDescs.data(), 0, inputs.NumDescs * sizeof(D3D12_RAYTRACING_INSTANCE_DESC));
+            updateInstanceDescs(pContext, tlas);
             asDesc.SourceAccelerationStructureData = tlas.pTlas->getGpuAddress(); // Perform the update in-place
         }
 
@@ -1047,7 +1854,7 @@ namespace Falcor
             tlas.pSrv = std::make_shared<ShaderResourceView>(pWeak, pSet, 0, 1, 0, 1);
         }
 
-        mTlasCache[rayCount] = tlas;
+        tlas.epoch = mTlasEpoch;
     }
 
     void Scene::setGeometryIndexIntoRtVars(const std::shared_ptr<RtProgramVars>& pVars)
@@ -1106,22 +1913,36 @@ namespace Falcor
         //
         // It really seems like a first-class notion of ray types (and the number thereof) is required.
         //
-        auto tlasIt = mTlasCache.find(rayTypeCount);
-        if (tlasIt == mTlasCache.end())
+        // The TLAS only depends on the ray count through InstanceContributionToHitGroupIndex, which is the hit group stride times the mesh index.
+        // All programs with as many hit groups as the largest program share one TLAS built with that stride.
+        if (rayTypeCount > mTlasHitGroupStride)
         {
-            // We need a hit entry per mesh right now to pass GeometryIndex()
-            buildTlas(pContext, rayTypeCount, true);
+            // Keep the TLAS of the previous stride for the programs that still use it
+            if (mTlas.pTlas) mTlasCache[mTlasHitGroupStride] = std::move(mTlas);
+            mTlas = mTlasCache.count(rayTypeCount) ? std::move(mTlasCache[rayTypeCount]) : TlasData();
+            mTlasCache.erase(rayTypeCount);
+            mTlasHitGroupStride = rayTypeCount;
+        }
 
-            // If new TLAS was just created, get it so the iterator is valid
-            if (tlasIt == mTlasCache.end()) tlasIt = mTlasCache.find(rayTypeCount);
+        // A program with fewer hit groups has fewer shader table records per mesh, so it needs a TLAS of its own.
+        // Padding the program with unused hit groups up to getHitGroupStride() lets it share the TLAS instead.
+        // The warning is logged once per hit group count. The TLAS cache is cleared whenever the masks change, so it can't tell.
+        bool shared = rayTypeCount == mTlasHitGroupStride;
+        if (!shared && mTlasStrideWarnings.insert(rayTypeCount).second)
+        {
+            logWarning("Scene: a program with " + std::to_string(rayTypeCount) + " hit groups needs its own TLAS, the shared TLAS has a hit group stride of " + std::to_string(mTlasHitGroupStride));
         }
+        TlasData& tlas = shared ? mTlas : mTlasCache[rayTypeCount];
+
+        // We need a hit entry per mesh right now to pass GeometryIndex()
+        if (tlas.pTlas == nullptr || tlas.epoch != mTlasEpoch) buildTlas(pContext, tlas, rayTypeCount, true);
 
         // Bind Scene parameter block.
         mCamera.pObject->setShaderData(mpSceneBlock[kCamera]);
         var["gScene"] = mpSceneBlock;
 
         // Bind TLAS.
-        var["gRtScene"].setSrv(tlasIt->second.pSrv);
+        var["gRtScene"].setSrv(tlas.pSrv);
     }
 
     void Scene::setEnvironmentMap(Texture::ConstSharedPtrRef pEnvMap)
@@ -1232,6 +2053,7 @@ namespace Falcor
         s.func_("light", &Scene::getLight); // PYTHONDEPRECATED
         s.func_("light", &Scene::getLightByName); // PYTHONDEPRECATED
         s.func_(kGetMaterial.c_str(), &Scene::getMaterial, "index"_a);
+        s.func_(kSetMeshInstanceMask.c_str(), &Scene::setMeshInstanceMask, "meshID"_a, "mask"_a);
         s.func_(kGetMaterial.c_str(), &Scene::getMaterialByName, "name"_a);
         s.func_("material", &Scene::getMaterial); // PYTHONDEPRECATED
         s.func_("material", &Scene::getMaterialByName); // PYTHONDEPRECATED
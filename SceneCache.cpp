@@ -0,0 +1,218 @@
+/***************************************************************************
+ # Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "stdafx.h"
+#include "SceneCache.h"
+#include <cstdio>
+#include <fstream>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Falcor
+{
+    namespace
+    {
+        const char kMagic[8] = { 'F', 'S', 'C', 'A', 'C', 'H', 'E', '\0' };
+        const uint64_t kSectionAlignment = 16;
+
+        struct FileHeader
+        {
+            char magic[8];
+            uint32_t version;
+            uint32_t sectionCount;
+            uint64_t key;
+        };
+
+        struct SectionEntry
+        {
+            uint32_t section;
+            uint32_t reserved;
+            uint64_t offset;
+            uint64_t size;
+        };
+
+        uint64_t alignUp(uint64_t value, uint64_t alignment)
+        {
+            return (value + alignment - 1) / alignment * alignment;
+        }
+    }
+
+    uint64_t SceneCache::hashBytes(const void* pData, size_t size, uint64_t seed)
+    {
+        const uint8_t* pBytes = reinterpret_cast<const uint8_t*>(pData);
+        uint64_t hash = seed;
+        for (size_t i = 0; i < size; i++)
+        {
+            hash ^= pBytes[i];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    uint64_t SceneCache::hashFile(const std::string& path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) return 0;
+
+        const uint32_t version = kVersion;
+        uint64_t hash = hashBytes(&version, sizeof(version));
+        std::vector<char> buffer(1 << 20);
+        while (file)
+        {
+            file.read(buffer.data(), buffer.size());
+            hash = hashBytes(buffer.data(), (size_t)file.gcount(), hash);
+        }
+        return hash;
+    }
+
+    void SceneCache::Writer::addSection(Section section, const void* pData, size_t size)
+    {
+        const uint8_t* pBytes = reinterpret_cast<const uint8_t*>(pData);
+        for (auto& entry : mSections)
+        {
+            if (entry.first != section) continue;
+            entry.second.assign(pBytes, pBytes + size);
+            return;
+        }
+        mSections.push_back({ section, std::vector<uint8_t>(pBytes, pBytes + size) });
+    }
+
+    bool SceneCache::Writer::write(const std::string& path, uint64_t key) const
+    {
+        FileHeader header = {};
+        std::memcpy(header.magic, kMagic, sizeof(kMagic));
+        header.version = kVersion;
+        header.sectionCount = (uint32_t)mSections.size();
+        header.key = key;
+
+        std::vector<SectionEntry> entries(mSections.size());
+        uint64_t offset = alignUp(sizeof(FileHeader) + entries.size() * sizeof(SectionEntry), kSectionAlignment);
+        for (size_t i = 0; i < mSections.size(); i++)
+        {
+            entries[i] = { (uint32_t)mSections[i].first, 0, offset, mSections[i].second.size() };
+            offset = alignUp(offset + mSections[i].second.size(), kSectionAlignment);
+        }
+
+        std::string tempPath = path + ".tmp";
+        {
+            std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+            if (!file) return false;
+
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            file.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(SectionEntry));
+            for (size_t i = 0; i < mSections.size(); i++)
+            {
+                file.seekp(entries[i].offset);
+                file.write(reinterpret_cast<const char*>(mSections[i].second.data()), mSections[i].second.size());
+            }
+            if (!file) return false;
+        }
+
+        std::remove(path.c_str());
+        return std::rename(tempPath.c_str(), path.c_str()) == 0;
+    }
+
+    SceneCache::Reader::UniquePtr SceneCache::Reader::open(const std::string& path, uint64_t key)
+    {
+        UniquePtr pReader(new Reader());
+
+#ifdef _WIN32
+        HANDLE hFile = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (hFile == INVALID_HANDLE_VALUE) return nullptr;
+        pReader->mpFile = hFile;
+
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(hFile, &size) || size.QuadPart == 0) return nullptr;
+        pReader->mSize = (size_t)size.QuadPart;
+
+        HANDLE hMapping = CreateFileMappingA(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (hMapping == nullptr) return nullptr;
+        pReader->mpMapping = hMapping;
+
+        pReader->mpData = reinterpret_cast<const uint8_t*>(MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0));
+        if (pReader->mpData == nullptr) return nullptr;
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return nullptr;
+        pReader->mpFile = reinterpret_cast<void*>((intptr_t)fd + 1);
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) return nullptr;
+        pReader->mSize = (size_t)st.st_size;
+
+        void* pData = mmap(nullptr, pReader->mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (pData == MAP_FAILED) return nullptr;
+        pReader->mpData = reinterpret_cast<const uint8_t*>(pData);
+#endif
+
+        // Validate the header and the section table before handing out pointers into the file
+        if (pReader->mSize < sizeof(FileHeader)) return nullptr;
+        const FileHeader* pHeader = reinterpret_cast<const FileHeader*>(pReader->mpData);
+        if (std::memcmp(pHeader->magic, kMagic, sizeof(kMagic)) != 0 || pHeader->version != kVersion || pHeader->key != key) return nullptr;
+        if (sizeof(FileHeader) + (uint64_t)pHeader->sectionCount * sizeof(SectionEntry) > pReader->mSize) return nullptr;
+
+        const SectionEntry* pEntries = reinterpret_cast<const SectionEntry*>(pHeader + 1);
+        for (uint32_t i = 0; i < pHeader->sectionCount; i++)
+        {
+            if (pEntries[i].offset > pReader->mSize || pEntries[i].size > pReader->mSize - pEntries[i].offset) return nullptr;
+        }
+
+        return pReader;
+    }
+
+    SceneCache::Reader::~Reader()
+    {
+#ifdef _WIN32
+        if (mpData) UnmapViewOfFile(mpData);
+        if (mpMapping) CloseHandle(mpMapping);
+        if (mpFile) CloseHandle(mpFile);
+#else
+        if (mpData) munmap(const_cast<uint8_t*>(mpData), mSize);
+        if (mpFile) close((int)((intptr_t)mpFile - 1));
+#endif
+    }
+
+    const void* SceneCache::Reader::getSection(Section section, size_t& size) const
+    {
+        const FileHeader* pHeader = reinterpret_cast<const FileHeader*>(mpData);
+        const SectionEntry* pEntries = reinterpret_cast<const SectionEntry*>(pHeader + 1);
+        for (uint32_t i = 0; i < pHeader->sectionCount; i++)
+        {
+            if (pEntries[i].section != (uint32_t)section) continue;
+            size = (size_t)pEntries[i].size;
+            return mpData + pEntries[i].offset;
+        }
+        size = 0;
+        return nullptr;
+    }
+}
@@ -0,0 +1,154 @@
+/***************************************************************************
+ # Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#pragma once
+#include <cstring>
+#include <string>
+#include <vector>
+#include <memory>
+
+namespace Falcor
+{
+    /** Binary snapshot of the scene data computed by Scene::finalize(), and optionally the serialized BLASes.
+        The file is a header, a section table and 16-byte aligned sections. Readers memory-map the file and use the sections in place.
+        Caches are keyed by a hash of the scene source, so a stale cache is never read. This class doesn't need a GPU.
+    */
+    class SceneCache
+    {
+    public:
+        static const uint32_t kVersion = 1;     ///< Bump when the layout of a section changes.
+
+        enum class Section : uint32_t
+        {
+            SourceState,        ///< Hash of the scene data the cached results were computed from.
+            MeshDescs,
+            MeshInstances,      ///< Mesh instance data after sorting.
+            GroupOffsets,       ///< MeshGrouping::Result arrays.
+            GroupMeshes,
+            InstanceOrder,
+            MeshFirstInstance,
+            MeshInstanceCount,
+            Materials,
+            BlasOffsets,        ///< Offset of each BLAS in BlasData, plus the total size. Empty BLASes weren't cached.
+            BlasData,           ///< Serialized BLASes, each starting with the driver matching identifier.
+        };
+
+        /** FNV-1a hash of a byte range.
+            \param[in] seed Hash to continue from, so several ranges can be combined.
+        */
+        static uint64_t hashBytes(const void* pData, size_t size, uint64_t seed = kHashSeed);
+
+        /** Hash of the content of a file combined with the cache version.
+            \return The hash, or 0 if the file can't be read.
+        */
+        static uint64_t hashFile(const std::string& path);
+
+        /** Collects sections and writes them to a file.
+        */
+        class Writer
+        {
+        public:
+            /** Add a section. Adding a section that already exists replaces its data.
+            */
+            void addSection(Section section, const void* pData, size_t size);
+
+            template<typename T>
+            void addSection(Section section, const std::vector<T>& data) { addSection(section, data.data(), data.size() * sizeof(T)); }
+
+            /** Write the cache. The file is written under a temporary name and renamed, so readers never see a partial file.
+            */
+            bool write(const std::string& path, uint64_t key) const;
+
+        private:
+            std::vector<std::pair<Section, std::vector<uint8_t>>> mSections;
+        };
+
+        /** Read-only view of a memory-mapped cache file.
+        */
+        class Reader
+        {
+        public:
+            using UniquePtr = std::unique_ptr<Reader>;
+
+            /** Open and map a cache.
+                \return The reader, or nullptr if the file is missing, invalid, from another version or doesn't match the key.
+            */
+            static UniquePtr open(const std::string& path, uint64_t key);
+            ~Reader();
+
+            /** Get a section.
+                \return Pointer to the section in the mapped file, or nullptr if the section doesn't exist.
+            */
+            const void* getSection(Section section, size_t& size) const;
+
+            /** Get a section as an array of T.
+                \return False if the section doesn't exist or its size isn't a multiple of sizeof(T).
+            */
+            template<typename T>
+            bool getSection(Section section, const T*& pData, size_t& count) const
+            {
+                size_t size = 0;
+                pData = reinterpret_cast<const T*>(getSection(section, size));
+                count = size / sizeof(T);
+                return pData != nullptr && size % sizeof(T) == 0;
+            }
+
+            /** Copy a section into a vector.
+            */
+            template<typename T>
+            bool readSection(Section section, std::vector<T>& data) const
+            {
+                const T* pData = nullptr;
+                size_t count = 0;
+                if (!getSection(section, pData, count)) return false;
+                data.assign(pData, pData + count);
+                return true;
+            }
+
+            /** Check that a section holds the same bytes as data.
+            */
+            template<typename T>
+            bool matchesSection(Section section, const std::vector<T>& data) const
+            {
+                size_t size = 0;
+                const void* pData = getSection(section, size);
+                return pData != nullptr && size == data.size() * sizeof(T) && (size == 0 || std::memcmp(pData, data.data(), size) == 0);
+            }
+
+        private:
+            Reader() = default;
+
+            const uint8_t* mpData = nullptr;
+            size_t mSize = 0;
+            void* mpMapping = nullptr;  // Platform handles of the mapping
+            void* mpFile = nullptr;
+        };
+
+    private:
+        static const uint64_t kHashSeed = 14695981039346656037ull;
+    };
+}
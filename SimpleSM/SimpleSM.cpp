@@ -194,8 +194,9 @@ void SimpleSM::execute(RenderContext* pRenderContext, const RenderData& renderDa
     float4 clearColor(1, 0, 0, 1);
     pRenderContext->clearFbo(mShadowPass.pFbo.get(), clearColor, 1.0f, 0, FboAttachmentType::Depth | FboAttachmentType::Color);
   
+    // Only shadow casters inside the light's frustum are drawn into the shadow map
     if (mpScene != nullptr)
-        mpScene->render(pRenderContext, mShadowPass.mpGraphicsState.get(), mShadowPass.mpVars.get());
+        mpScene->render(pRenderContext, mShadowPass.mpGraphicsState.get(), mShadowPass.mpVars.get(), mShadowPass.lightVP, Scene::RenderFlags::None, kInstanceMaskCastsShadows);
 
     mVisibilityPass.mpVars["shadowMap"] = mShadowPass.pDepth;
     mVisibilityPass.mpVars["shadowMapLinear"] = mShadowPass.pDepthLinear;
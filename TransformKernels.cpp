@@ -0,0 +1,249 @@
+/***************************************************************************
+ # Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "stdafx.h"
+#include "TransformKernels.h"
+#include <chrono>
+#include <random>
+#include <xmmintrin.h>
+
+namespace Falcor
+{
+    namespace TransformKernels
+    {
+        namespace
+        {
+            // Rows of one column of four matrices, one matrix per lane
+            struct Column
+            {
+                __m128 row[4];
+            };
+
+            // Loads column c of four matrices and transposes it, so lane j holds the column of matrix j
+            Column loadColumn(const glm::mat4& m0, const glm::mat4& m1, const glm::mat4& m2, const glm::mat4& m3, int c)
+            {
+                Column col;
+                col.row[0] = _mm_loadu_ps(&m0[c][0]);
+                col.row[1] = _mm_loadu_ps(&m1[c][0]);
+                col.row[2] = _mm_loadu_ps(&m2[c][0]);
+                col.row[3] = _mm_loadu_ps(&m3[c][0]);
+                _MM_TRANSPOSE4_PS(col.row[0], col.row[1], col.row[2], col.row[3]);
+                return col;
+            }
+
+            __m128 abs(__m128 v)
+            {
+                return _mm_andnot_ps(_mm_set1_ps(-0.f), v);
+            }
+
+            // Returns a 4-bit mask of the matrices whose upper 3x3 has a negative determinant, det = dot(c0, cross(c1, c2))
+            int flipMask(const glm::mat4& m0, const glm::mat4& m1, const glm::mat4& m2, const glm::mat4& m3)
+            {
+                Column col0 = loadColumn(m0, m1, m2, m3, 0);
+                Column col1 = loadColumn(m0, m1, m2, m3, 1);
+                Column col2 = loadColumn(m0, m1, m2, m3, 2);
+                const __m128* a = col0.row;
+                const __m128* b = col1.row;
+                const __m128* c = col2.row;
+
+                __m128 crossX = _mm_sub_ps(_mm_mul_ps(b[1], c[2]), _mm_mul_ps(b[2], c[1]));
+                __m128 crossY = _mm_sub_ps(_mm_mul_ps(b[2], c[0]), _mm_mul_ps(b[0], c[2]));
+                __m128 crossZ = _mm_sub_ps(_mm_mul_ps(b[0], c[1]), _mm_mul_ps(b[1], c[0]));
+                __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[0], crossX), _mm_mul_ps(a[1], crossY)), _mm_mul_ps(a[2], crossZ));
+                return _mm_movemask_ps(_mm_cmplt_ps(det, _mm_setzero_ps()));
+            }
+        }
+
+        void computeFlips(const glm::mat4* pMatrices, size_t begin, size_t end, uint8_t* pFlipped)
+        {
+            size_t i = begin;
+            for (; i + 4 <= end; i += 4)
+            {
+                int mask = flipMask(pMatrices[i], pMatrices[i + 1], pMatrices[i + 2], pMatrices[i + 3]);
+                for (int j = 0; j < 4; j++) pFlipped[i + j] = (mask >> j) & 1;
+            }
+
+            // The tail repeats the last matrix in the unused lanes
+            if (i < end)
+            {
+                const glm::mat4& last = pMatrices[end - 1];
+                int mask = flipMask(pMatrices[i], i + 1 < end ? pMatrices[i + 1] : last, i + 2 < end ? pMatrices[i + 2] : last, last);
+                for (int j = 0; i + j < end; j++) pFlipped[i + j] = (mask >> j) & 1;
+            }
+        }
+
+        void transformBounds(const glm::mat4* pMatrices, const BoundingBox* pLocalBounds, const uint32_t* pMatrixIDs, const uint32_t* pBoundsIDs,
+            const uint32_t* pIndices, size_t indexCount, float* const pMin[3], float* const pMax[3])
+        {
+            for (size_t k = 0; k < indexCount; k += 4)
+            {
+                // Unused lanes of the last batch repeat its last entry and are not stored
+                uint32_t lanes = (uint32_t)std::min<size_t>(4, indexCount - k);
+                uint32_t index[4];
+                for (uint32_t j = 0; j < 4; j++) index[j] = pIndices[k + std::min(j, lanes - 1)];
+
+                const glm::mat4& m0 = pMatrices[pMatrixIDs[index[0]]];
+                const glm::mat4& m1 = pMatrices[pMatrixIDs[index[1]]];
+                const glm::mat4& m2 = pMatrices[pMatrixIDs[index[2]]];
+                const glm::mat4& m3 = pMatrices[pMatrixIDs[index[3]]];
+                Column cols[4] = { loadColumn(m0, m1, m2, m3, 0), loadColumn(m0, m1, m2, m3, 1), loadColumn(m0, m1, m2, m3, 2), loadColumn(m0, m1, m2, m3, 3) };
+
+                // Local bounds as center and half extent, one entry per lane
+                alignas(16) float center[3][4], extent[3][4];
+                for (uint32_t j = 0; j < 4; j++)
+                {
+                    const BoundingBox& bb = pLocalBounds[pBoundsIDs[index[j]]];
+                    float3 minPos = bb.getMinPos();
+                    float3 maxPos = bb.getMaxPos();
+                    for (int c = 0; c < 3; c++)
+                    {
+                        center[c][j] = 0.5f * (minPos[c] + maxPos[c]);
+                        extent[c][j] = 0.5f * (maxPos[c] - minPos[c]);
+                    }
+                }
+                __m128 cx = _mm_load_ps(center[0]), cy = _mm_load_ps(center[1]), cz = _mm_load_ps(center[2]);
+                __m128 ex = _mm_load_ps(extent[0]), ey = _mm_load_ps(extent[1]), ez = _mm_load_ps(extent[2]);
+
+                // The world center is M * center, the world half extent is |M| * extent
+                __m128 worldMin[3], worldMax[3];
+                for (int r = 0; r < 3; r++)
+                {
+                    __m128 wc = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cols[0].row[r], cx), _mm_mul_ps(cols[1].row[r], cy)), _mm_add_ps(_mm_mul_ps(cols[2].row[r], cz), cols[3].row[r]));
+                    __m128 we = _mm_add_ps(_mm_add_ps(_mm_mul_ps(abs(cols[0].row[r]), ex), _mm_mul_ps(abs(cols[1].row[r]), ey)), _mm_mul_ps(abs(cols[2].row[r]), ez));
+                    worldMin[r] = _mm_sub_ps(wc, we);
+                    worldMax[r] = _mm_add_ps(wc, we);
+                }
+
+                // Contiguous entries are stored directly, scattered ones one lane at a time
+                if (lanes == 4 && index[3] == index[0] + 3 && index[1] == index[0] + 1 && index[2] == index[0] + 2)
+                {
+                    for (int c = 0; c < 3; c++)
+                    {
+                        _mm_storeu_ps(pMin[c] + index[0], worldMin[c]);
+                        _mm_storeu_ps(pMax[c] + index[0], worldMax[c]);
+                    }
+                }
+                else
+                {
+                    alignas(16) float lanesMin[4], lanesMax[4];
+                    for (int c = 0; c < 3; c++)
+                    {
+                        _mm_store_ps(lanesMin, worldMin[c]);
+                        _mm_store_ps(lanesMax, worldMax[c]);
+                        for (uint32_t j = 0; j < lanes; j++)
+                        {
+                            pMin[c][index[j]] = lanesMin[j];
+                            pMax[c][index[j]] = lanesMax[j];
+                        }
+                    }
+                }
+            }
+        }
+
+        bool runBenchmark(uint32_t matrixCount)
+        {
+            // Random affine transforms, a third of them mirrored. Each entry picks a random matrix and local bounds like scene instances do.
+            std::mt19937 rng(1234);
+            std::uniform_real_distribution<float> angle(0.f, 6.2831853f);
+            std::uniform_real_distribution<float> coord(-100.f, 100.f);
+            std::uniform_real_distribution<float> scale(0.1f, 4.f);
+
+            std::vector<glm::mat4> matrices(matrixCount);
+            for (auto& m : matrices)
+            {
+                float3 s(scale(rng), scale(rng), scale(rng));
+                if (rng() % 3 == 0) s.x = -s.x;
+                m = glm::translate(glm::identity<glm::mat4>(), float3(coord(rng), coord(rng), coord(rng)));
+                m = glm::rotate(m, angle(rng), glm::normalize(float3(coord(rng), coord(rng), coord(rng) + 0.1f)));
+                m = glm::scale(m, s);
+            }
+
+            uint32_t boundsCount = std::max(matrixCount / 4, 1u);
+            std::vector<BoundingBox> localBounds(boundsCount);
+            for (auto& bb : localBounds)
+            {
+                float3 c(coord(rng), coord(rng), coord(rng));
+                bb = BoundingBox::fromMinMax(c - float3(scale(rng)), c + float3(scale(rng)));
+            }
+
+            std::vector<uint32_t> matrixIDs(matrixCount), boundsIDs(matrixCount), indices(matrixCount);
+            for (uint32_t i = 0; i < matrixCount; i++)
+            {
+                matrixIDs[i] = rng() % matrixCount;
+                boundsIDs[i] = rng() % boundsCount;
+                indices[i] = i;
+            }
+
+            using Clock = std::chrono::high_resolution_clock;
+            auto ms = [](Clock::time_point t0) { return std::chrono::duration<double, std::milli>(Clock::now() - t0).count(); };
+
+            // Scalar reference, the code Scene used before
+            auto t0 = Clock::now();
+            std::vector<uint8_t> referenceFlips(matrixCount);
+            for (uint32_t i = 0; i < matrixCount; i++) referenceFlips[i] = glm::determinant((glm::mat3)matrices[i]) < 0.f;
+            double referenceFlipMs = ms(t0);
+
+            t0 = Clock::now();
+            std::vector<BoundingBox> referenceBounds(matrixCount);
+            for (uint32_t i = 0; i < matrixCount; i++) referenceBounds[i] = localBounds[boundsIDs[i]].transform(matrices[matrixIDs[i]]);
+            double referenceBoundsMs = ms(t0);
+
+            t0 = Clock::now();
+            std::vector<uint8_t> flips(matrixCount);
+            computeFlips(matrices.data(), 0, matrixCount, flips.data());
+            double flipMs = ms(t0);
+
+            t0 = Clock::now();
+            std::vector<float> minPos[3], maxPos[3];
+            for (int c = 0; c < 3; c++)
+            {
+                minPos[c].resize(matrixCount);
+                maxPos[c].resize(matrixCount);
+            }
+            float* const pMin[3] = { minPos[0].data(), minPos[1].data(), minPos[2].data() };
+            float* const pMax[3] = { maxPos[0].data(), maxPos[1].data(), maxPos[2].data() };
+            transformBounds(matrices.data(), localBounds.data(), matrixIDs.data(), boundsIDs.data(), indices.data(), matrixCount, pMin, pMax);
+            double boundsMs = ms(t0);
+
+            // The kernels use a different order of operations, so bounds are compared with a tolerance relative to their size
+            bool match = flips == referenceFlips;
+            for (uint32_t i = 0; i < matrixCount && match; i++)
+            {
+                float3 refMin = referenceBounds[i].getMinPos();
+                float3 refMax = referenceBounds[i].getMaxPos();
+                float tolerance = 1e-4f * (1.f + std::max(std::abs(refMin.x), std::abs(refMax.x)) + std::max(std::abs(refMin.y), std::abs(refMax.y)) + std::max(std::abs(refMin.z), std::abs(refMax.z)));
+                for (int c = 0; c < 3; c++) match = match && std::abs(minPos[c][i] - refMin[c]) <= tolerance && std::abs(maxPos[c][i] - refMax[c]) <= tolerance;
+            }
+
+            logInfo("TransformKernels benchmark, " + std::to_string(matrixCount) + " transforms: flip test " + std::to_string(referenceFlipMs) + " ms scalar, "
+                + std::to_string(flipMs) + " ms SSE; bounds " + std::to_string(referenceBoundsMs) + " ms scalar, " + std::to_string(boundsMs) + " ms SSE, "
+                + (match ? "matching" : "NOT MATCHING"));
+            if (!match) logError("TransformKernels: the SSE kernels don't match the scalar code");
+            return match;
+        }
+    }
+}
@@ -0,0 +1,54 @@
+/***************************************************************************
+ # Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#pragma once
+
+namespace Falcor
+{
+    /** SSE kernels over arrays of transforms. Four matrices are loaded at a time and transposed in registers, so each lane works on one matrix.
+        The matrices stay in the layout of the animation controller, the structure-of-arrays form only exists in registers.
+    */
+    namespace TransformKernels
+    {
+        /** For each matrix in [begin, end), write 1 to pFlipped if its upper 3x3 has a negative determinant and 0 otherwise.
+        */
+        void computeFlips(const glm::mat4* pMatrices, size_t begin, size_t end, uint8_t* pFlipped);
+
+        /** Transform local bounds into world space and write them as structure-of-arrays min and max positions.
+            Entry i uses matrix pMatrixIDs[i] and local bounds pBoundsIDs[i]. Only the entries listed in pIndices are written.
+            \param[in] pMin Arrays of the x, y and z world-space minimums, indexed by entry.
+            \param[in] pMax Arrays of the x, y and z world-space maximums, indexed by entry.
+        */
+        void transformBounds(const glm::mat4* pMatrices, const BoundingBox* pLocalBounds, const uint32_t* pMatrixIDs, const uint32_t* pBoundsIDs,
+            const uint32_t* pIndices, size_t indexCount, float* const pMin[3], float* const pMax[3]);
+
+        /** Check the kernels against the scalar glm code on random transforms and log both timings.
+            \return True if the results match.
+        */
+        bool runBenchmark(uint32_t matrixCount);
+    }
+}
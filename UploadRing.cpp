@@ -0,0 +1,146 @@
+/***************************************************************************
+ # Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "stdafx.h"
+#include "UploadRing.h"
+
+namespace Falcor
+{
+    UploadRing::SharedPtr UploadRing::create(uint64_t size)
+    {
+        return SharedPtr(new UploadRing(size));
+    }
+
+    UploadRing::UploadRing(uint64_t size)
+    {
+        mpFence = GpuFence::create();
+        createBuffer(size);
+    }
+
+    UploadRing::~UploadRing()
+    {
+        if (mpBuffer) mpBuffer->unmap();
+    }
+
+    void UploadRing::createBuffer(uint64_t size)
+    {
+        if (mpBuffer) mpBuffer->unmap();
+
+        // The old buffer is released once the GPU is done with it, so pending copies from it are still valid
+        mCapacity = size;
+        mpBuffer = Buffer::create(size, Buffer::BindFlags::None, Buffer::CpuAccess::Write);
+        mpData = (uint8_t*)mpBuffer->map(Buffer::MapType::Write);
+        mHead = mTail = mFrameHead = 0;
+        mPending.clear();
+    }
+
+    void UploadRing::retire(bool wait)
+    {
+        // Release the oldest fenced range. If the GPU isn't done with it and the caller needs the space, wait.
+        assert(!mPending.empty());
+        if (mPending.front().fenceValue > mpFence->getGpuValue())
+        {
+            if (!wait) return;
+            mpFence->syncCpu();
+        }
+        mTail = mPending.front().head;
+        mPending.pop_front();
+    }
+
+    UploadRing::Allocation UploadRing::allocate(uint64_t size, uint64_t alignment)
+    {
+        assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+
+        // Release ranges the GPU is done with
+        while (!mPending.empty() && mPending.front().fenceValue <= mpFence->getGpuValue()) retire(false);
+
+        // An allocation can't wrap around the end of the buffer, so skip to the start if it doesn't fit
+        uint64_t start = (mHead + alignment - 1) & ~(alignment - 1);
+        if ((start % mCapacity) + size > mCapacity) start = (start / mCapacity + 1) * mCapacity;
+        uint64_t end = start + size;
+
+        // Wait for the GPU if the ring is full
+        while (end - mTail > mCapacity && !mPending.empty()) retire(true);
+
+        // Allocations from frames that aren't fenced yet still fill the ring, so grow it
+        if (end - mTail > mCapacity)
+        {
+            uint64_t capacity = mCapacity * 2;
+            while (capacity < size + alignment) capacity *= 2;
+            logWarning("UploadRing: a frame uploaded more than " + std::to_string(mCapacity) + " bytes, growing the ring to " + std::to_string(capacity) + " bytes");
+            createBuffer(capacity);
+            return allocate(size, alignment);
+        }
+
+        mHead = end;
+
+        Allocation alloc;
+        alloc.pBuffer = mpBuffer.get();
+        alloc.offset = start % mCapacity;
+        alloc.pData = mpData + alloc.offset;
+        return alloc;
+    }
+
+    void UploadRing::upload(CopyContext* pContext, const Buffer* pDst, uint64_t dstOffset, const void* pData, uint64_t size)
+    {
+        Allocation alloc = allocate(size);
+        std::memcpy(alloc.pData, pData, size);
+        pContext->copyBufferRegion(pDst, dstOffset, alloc.pBuffer, alloc.offset, size);
+    }
+
+    void UploadRing::uploadRanges(CopyContext* pContext, const Buffer* pDst, const void* pSrc, uint64_t elementSize, DirtyRangeTracker& ranges)
+    {
+        if (ranges.empty()) return;
+
+        Allocation alloc = allocate(ranges.getElementCount() * elementSize);
+        uint64_t offset = 0;
+        for (const auto& range : ranges.getRanges())
+        {
+            uint64_t size = (range.end - range.begin) * elementSize;
+            std::memcpy(alloc.pData + offset, (const uint8_t*)pSrc + range.begin * elementSize, size);
+            pContext->copyBufferRegion(pDst, range.begin * elementSize, alloc.pBuffer, alloc.offset + offset, size);
+            offset += size;
+        }
+        ranges.clear();
+    }
+
+    void UploadRing::submit(CopyContext* pContext)
+    {
+        pContext->flush(false);
+        beginFrame(pContext);
+    }
+
+    void UploadRing::beginFrame(CopyContext* pContext)
+    {
+        if (mHead != mFrameHead)
+        {
+            uint64_t fenceValue = mpFence->gpuSignal(pContext->getLowLevelData()->getCommandQueue());
+            mPending.push_back({ fenceValue, mHead });
+        }
+        mFrameHead = mHead;
+    }
+}
@@ -0,0 +1,105 @@
+/***************************************************************************
+ # Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#pragma once
+#include "DirtyRangeTracker.h"
+#include <deque>
+
+namespace Falcor
+{
+    /** Persistently mapped upload buffer used as a ring.
+        Data is written directly into the mapped memory and then copied on the GPU with copyBufferRegion().
+        Memory is recycled once the GPU has passed the fence that follows its frame, so updates never stall on a map or a flush.
+    */
+    class UploadRing
+    {
+    public:
+        using SharedPtr = std::shared_ptr<UploadRing>;
+
+        struct Allocation
+        {
+            const Buffer* pBuffer = nullptr;    ///< Upload buffer to copy from.
+            uint64_t offset = 0;                ///< Offset of the allocation in pBuffer.
+            uint8_t* pData = nullptr;           ///< CPU pointer to the allocation.
+        };
+
+        /** Create a ring.
+            \param[in] size Initial capacity in bytes. The ring grows if a frame uses more than that.
+        */
+        static SharedPtr create(uint64_t size);
+        ~UploadRing();
+
+        /** Allocate memory for this frame's uploads. The memory stays valid until the GPU has finished the frame.
+        */
+        Allocation allocate(uint64_t size, uint64_t alignment = 16);
+
+        /** Allocate memory and copy data into it, then copy it to a GPU buffer.
+        */
+        void upload(CopyContext* pContext, const Buffer* pDst, uint64_t dstOffset, const void* pData, uint64_t size);
+
+        /** Copy the dirty ranges of a CPU array to the same ranges of a GPU buffer. All ranges share one allocation.
+            \param[in] pSrc CPU array mirroring the buffer.
+            \param[in] elementSize Size of an array element in bytes.
+            \param[in] ranges Dirty ranges. They are cleared after the upload.
+        */
+        void uploadRanges(CopyContext* pContext, const Buffer* pDst, const void* pSrc, uint64_t elementSize, DirtyRangeTracker& ranges);
+
+        /** Submit the commands recorded so far and fence the memory they read, so it can be reused within the frame.
+            Loaders call this between chunks to bound their staging memory.
+        */
+        void submit(CopyContext* pContext);
+
+        /** Mark the start of a new frame. Call once per frame, before this frame's allocations.
+            The previous frame's commands have been submitted by then, so the fence signaled here is ordered after every copy that reads its memory.
+        */
+        void beginFrame(CopyContext* pContext);
+
+        uint64_t getCapacity() const { return mCapacity; }
+
+    private:
+        UploadRing(uint64_t size);
+        void createBuffer(uint64_t size);
+        void retire(bool wait);
+
+        Buffer::SharedPtr mpBuffer;
+        uint8_t* mpData = nullptr;
+        uint64_t mCapacity = 0;
+        GpuFence::SharedPtr mpFence;
+
+        // Positions are monotonic byte counters. The ring offset is the position modulo the capacity.
+        uint64_t mHead = 0;         ///< Next free byte.
+        uint64_t mTail = 0;         ///< Oldest byte that may still be read by the GPU.
+        uint64_t mFrameHead = 0;    ///< Head at the start of the current frame.
+
+        struct PendingRange
+        {
+            uint64_t fenceValue;
+            uint64_t head;
+        };
+        std::deque<PendingRange> mPending;
+    };
+}
@@ -27,6 +27,19 @@
  **************************************************************************/
 #include "WireframePass.h"
 
+namespace
+{
+    const char kMode[] = "mode";
+    const char kLineWidth[] = "lineWidth";
+    const char kColor[] = "color";
+
+    const Gui::DropdownList kModeList =
+    {
+        { (uint32_t)WireframePass::Mode::Rasterizer, "Rasterizer" },
+        { (uint32_t)WireframePass::Mode::Barycentric, "Barycentric overlay" },
+    };
+}
+
 // Don't remove this. it's required for hot-reload to function properly
 extern "C" __declspec(dllexport) const char* getProjDir()
 {
@@ -41,41 +54,107 @@ extern "C" __declspec(dllexport) void getPasses(Falcor::RenderPassLibrary& lib)
 WireframePass::SharedPtr WireframePass::create(RenderContext* pRenderContext, const Dictionary& dict)
 {
     SharedPtr pPass = SharedPtr(new WireframePass);
+
+    for (const auto& v : dict) {
+        if (v.key() == kMode) pPass->mMode = (Mode)(uint32_t)v.val();
+        else if (v.key() == kLineWidth) pPass->mLineWidth = v.val();
+        else if (v.key() == kColor) pPass->mColor = v.val();
+        else logWarning("Unknown field '" + v.key() + "' in a WireframePass dictionary");
+    }
+
+    if (pPass->mMode == Mode::Barycentric && !pPass->mOverlaySupported)
+    {
+        logWarning("WireframePass: barycentric overlay is not supported on this device, falling back to rasterizer mode");
+        pPass->mMode = Mode::Rasterizer;
+    }
+
     return pPass;
 }
 
 Dictionary WireframePass::getScriptingDictionary()
 {
-    return Dictionary();
+    Dictionary dict;
+    dict[kMode] = (uint32_t)mMode;
+    dict[kLineWidth] = mLineWidth;
+    dict[kColor] = mColor;
+    return dict;
 }
 
 RenderPassReflection WireframePass::reflect(const CompileData& compileData)
 {
     // Define the required resources here
     RenderPassReflection reflector;
-    //reflector.addInput("input", "the source texture");
+    reflector.addInput("src", "Image to draw the wireframe over").flags(RenderPassReflection::Field::Flags::Optional);
+    reflector.addInput("depth", "Depth buffer used to hide occluded edges in overlay mode").bindFlags(ResourceBindFlags::DepthStencil).flags(RenderPassReflection::Field::Flags::Optional);
     reflector.addOutput("output", "the destination texture");
     return reflector;
 }
 
+void WireframePass::compile(RenderContext* pContext, const CompileData& compileData)
+{
+    // The graph may have reallocated its resources
+    mpFbo = nullptr;
+}
+
 void WireframePass::execute(RenderContext* pRenderContext, const RenderData& renderData)
 {
-    auto pTargetFbo = Fbo::create({ renderData["output"]->asTexture() });
-    const float4 clearColor(0, 0, 0, 1);
-    pRenderContext->clearFbo(pTargetFbo.get(), clearColor, 1.0f, 0, FboAttachmentType::All);
-    mpGraphicsState->setFbo(pTargetFbo);
+    PROFILE("WireframePass");
+
+    // The depth buffer is only used to hide edges in overlay mode
+    const auto& pOutput = renderData["output"]->asTexture();
+    Texture::SharedPtr pDepth = (mMode == Mode::Barycentric && renderData["depth"]) ? renderData["depth"]->asTexture() : nullptr;
+
+    // Only rebuild the FBO when the output resource changes (resize or graph recompile)
+    if (mpFbo == nullptr || mpFbo->getColorTexture(0) != pOutput || mpFbo->getDepthStencilTexture() != pDepth)
+    {
+        mpFbo = Fbo::create({ pOutput }, pDepth);
+        mpGraphicsState->setFbo(mpFbo);
+        mOverlayPass.mpGraphicsState->setFbo(mpFbo);
+        mOverlayPass.mpGraphicsState->setDepthStencilState(pDepth ? mOverlayPass.mpDepthTestDS : mOverlayPass.mpNoDepthDS);
+    }
+
+    // Draw over the source image if there is one
+    if (renderData["src"])
+    {
+        pRenderContext->blit(renderData["src"]->asTexture()->getSRV(), pOutput->getRTV());
+    }
+    else
+    {
+        const float4 clearColor(0, 0, 0, 1);
+        pRenderContext->clearFbo(mpFbo.get(), clearColor, 1.0f, 0, FboAttachmentType::Color);
+    }
+
+    if (mpScene == nullptr) return;
 
     // Set render state
     Scene::RenderFlags renderFlags = Scene::RenderFlags::UserRasterizerState;
-    if (mpVars != nullptr)
-        mpVars["PerFrameCB"]["gColor"] = float4(0, 1, 0, 1);
 
-    if (mpScene != nullptr)
+    if (mMode == Mode::Barycentric)
+    {
+        mOverlayPass.mpVars["PerFrameCB"]["gColor"] = mColor;
+        mOverlayPass.mpVars["PerFrameCB"]["gLineWidth"] = mLineWidth;
+        mpScene->render(pRenderContext, mOverlayPass.mpGraphicsState.get(), mOverlayPass.mpVars.get(), renderFlags);
+    }
+    else
+    {
+        mpVars["PerFrameCB"]["gColor"] = mColor;
         mpScene->render(pRenderContext, mpGraphicsState.get(), mpVars.get(), renderFlags);
+    }
 }
 
 void WireframePass::renderUI(Gui::Widgets& widget)
 {
+    if (mOverlaySupported)
+    {
+        uint32_t mode = (uint32_t)mMode;
+        if (widget.dropdown("Mode", kModeList, mode)) mMode = (Mode)mode;
+    }
+    else
+    {
+        widget.text("Barycentric overlay requires SV_Barycentrics support");
+    }
+    widget.rgbaColor("Color", mColor);
+    if (mMode == Mode::Barycentric) widget.var("Line width", mLineWidth, 0.5f, 16.0f, 0.25f);
 }
 
 void WireframePass::setScene(RenderContext* pRenderContext, const Scene::SharedPtr& pScene)
@@ -83,6 +162,12 @@ void WireframePass::setScene(RenderContext* pRenderContext, const Scene::SharedP
     mpScene = pScene;
     mpProgram->addDefines(mpScene->getSceneDefines());
     mpVars = GraphicsVars::create(mpProgram->getReflector());
+
+    if (mOverlaySupported)
+    {
+        mOverlayPass.mpProgram->addDefines(mpScene->getSceneDefines());
+        mOverlayPass.mpVars = GraphicsVars::create(mOverlayPass.mpProgram->getReflector());
+    }
 }
 
 WireframePass::WireframePass()
@@ -97,4 +182,38 @@ WireframePass::WireframePass()
     mpGraphicsState = GraphicsState::create();
     mpGraphicsState->setProgram(mpProgram);
     mpGraphicsState->setRasterizerState(mpRasterState);
+
+    // Overlay mode draws solid, unculled triangles and blends the edge coverage over the target.
+    // The pixel shader reads SV_Barycentrics, which needs SM 6.1 and driver support.
+    mOverlaySupported = gpDevice->isFeatureSupported(Device::SupportedFeatures::Barycentrics);
+    if (mOverlaySupported)
+    {
+        GraphicsProgram::Desc overlayDesc;
+        overlayDesc.addShaderLibrary("RenderPasses/WireframePass/WireframeOverlay.slang");
+        overlayDesc.vsEntry("vsMain").psEntry("psMain");
+        overlayDesc.setShaderModel("6_1");
+        mOverlayPass.mpProgram = GraphicsProgram::create(overlayDesc);
+    }
+
+    RasterizerState::Desc solidDesc;
+    solidDesc.setCullMode(RasterizerState::CullMode::None);
+
+    BlendState::Desc blendDesc;
+    blendDesc.setRtBlend(0, true);
+    blendDesc.setRtParams(0, BlendState::BlendOp::Add, BlendState::BlendOp::Add, BlendState::BlendFunc::SrcAlpha, BlendState::BlendFunc::OneMinusSrcAlpha, BlendState::BlendFunc::One, BlendState::BlendFunc::One);
+
+    // Edges are hidden by the source depth buffer, but must not write to it
+    DepthStencilState::Desc depthTestDesc;
+    depthTestDesc.setDepthFunc(DepthStencilState::Func::LessEqual).setDepthWriteMask(false);
+    mOverlayPass.mpDepthTestDS = DepthStencilState::create(depthTestDesc);
+
+    DepthStencilState::Desc noDepthDesc;
+    noDepthDesc.setDepthEnabled(false);
+    mOverlayPass.mpNoDepthDS = DepthStencilState::create(noDepthDesc);
+
+    mOverlayPass.mpGraphicsState = GraphicsState::create();
+    mOverlayPass.mpGraphicsState->setProgram(mOverlayPass.mpProgram);
+    mOverlayPass.mpGraphicsState->setRasterizerState(RasterizerState::create(solidDesc));
+    mOverlayPass.mpGraphicsState->setBlendState(BlendState::create(blendDesc));
+    mOverlayPass.mpGraphicsState->setDepthStencilState(mOverlayPass.mpNoDepthDS);
 }
@@ -47,19 +47,40 @@ public:
     virtual std::string getDesc() override { return "Insert pass description here"; }
     virtual Dictionary getScriptingDictionary() override;
     virtual RenderPassReflection reflect(const CompileData& compileData) override;
-    virtual void compile(RenderContext* pContext, const CompileData& compileData) override {}
+    virtual void compile(RenderContext* pContext, const CompileData& compileData) override;
     virtual void execute(RenderContext* pRenderContext, const RenderData& renderData) override;
     virtual void renderUI(Gui::Widgets& widget) override;
     virtual void setScene(RenderContext* pRenderContext, const Scene::SharedPtr& pScene) override;
     virtual bool onMouseEvent(const MouseEvent& mouseEvent) override { return false; }
     virtual bool onKeyEvent(const KeyboardEvent& keyEvent) override { return false; }
 
+    enum class Mode : uint32_t
+    {
+        Rasterizer,     ///< Rasterizer fill-mode wireframe.
+        Barycentric,    ///< Solid triangles, edges found from barycentrics in the pixel shader. Can overlay the "src" input.
+    };
+
 private:
     WireframePass();
 
+    Mode mMode = Mode::Rasterizer;
+    bool mOverlaySupported = false;     ///< Barycentric mode needs SV_Barycentrics (SM 6.1). Without it the pass stays in rasterizer mode.
+    float mLineWidth = 1.5f;
+    float4 mColor = float4(0, 1, 0, 1);
+
     Scene::SharedPtr mpScene;
     GraphicsProgram::SharedPtr mpProgram;
     GraphicsState::SharedPtr mpGraphicsState;
     RasterizerState::SharedPtr mpRasterState;
     GraphicsVars::SharedPtr mpVars;
+    Fbo::SharedPtr mpFbo;
+
+    struct
+    {
+        GraphicsProgram::SharedPtr mpProgram;
+        GraphicsState::SharedPtr mpGraphicsState;
+        GraphicsVars::SharedPtr mpVars;
+        DepthStencilState::SharedPtr mpDepthTestDS;
+        DepthStencilState::SharedPtr mpNoDepthDS;
+    } mOverlayPass;
 };